@@ -9,11 +9,13 @@
 #include <string>
 #include <ctime>
 #include <cstdio>
+#include <cfloat>
 
 #include <opencv2/core.hpp>
 #include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
+#include <opencv2/video/tracking.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
@@ -24,7 +26,13 @@ using namespace std;
 static void help()
 {
     cout <<  "This is a camera calibration sample." << endl
-         <<  "Usage: camera_calibration [configuration_file -- default ./default.xml]"  << endl
+         <<  "Usage: camera_calibration [configuration_file -- default ./default.xml] [--batch] [--track] [--incremental]"  << endl
+         <<  "With --batch an image list is searched for the pattern on all cores and calibrated "
+             "without display." << endl
+         <<  "With --track a chessboard seen by the camera is followed from frame to frame, and "
+             "only searched again when it is lost." << endl
+         <<  "With --incremental only the views that add a new pose or a new part of the frame "
+             "are kept, and the calibration stops as soon as its estimate settles." << endl
          <<  "Near the sample file you'll find the configuration file, which has detailed help of "
              "how to edit it.  It may be any OpenCV supported file format XML/YAML." << endl;
 }
@@ -254,7 +262,428 @@ static inline void read(const FileNode& node, Settings& x, const Settings& defau
 enum { DETECTION = 0, CAPTURING = 1, CALIBRATED = 2 };
 
 bool runCalibrationAndSave(Settings& s, Size imageSize, Mat&  cameraMatrix, Mat& distCoeffs,
-                           vector<vector<Point2f> > imagePoints );
+                           vector<vector<Point2f> > imagePoints, bool useIntrinsicGuess = false );
+static void calcBoardCornerPositions(Size boardSize, float squareSize, vector<Point3f>& corners,
+                                     Settings::Pattern patternType /*= Settings::CHESSBOARD*/);
+
+// The chessboard is searched on a copy halved (at most twice) down to
+// about this width, then its corners are refined at full resolution
+static const int SEARCH_WIDTH = 640;
+
+// Chessboard corners searched on a downscaled copy of the view and mapped
+// back to full-resolution coordinates, for cornerSubPix to refine
+static bool findChessboardDownscaled(const Mat& view, Size boardSize, vector<Point2f>& pointBuf,
+                                     int flags)
+{
+    Mat small = view;
+    int scale = 1;
+    while (scale < 4 && view.cols / (2*scale) >= SEARCH_WIDTH)
+    {
+        pyrDown(small, small);
+        scale *= 2;
+    }
+    if (!findChessboardCorners( small, boardSize, pointBuf, flags))
+        return false;
+    // pixel x of a pyrDown level is centred on pixel 2x of the level below
+    for (size_t i = 0; i < pointBuf.size(); ++i)
+        pointBuf[i] *= (float)scale;
+    return true;
+}
+
+// Feature points of the calibration pattern in one view, refined to
+// subpixel accuracy for the chessboard
+static bool findPattern(const Settings& s, const Mat& view, vector<Point2f>& pointBuf)
+{
+    bool found;
+
+    int chessBoardFlags = CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE;
+
+    if(!s.useFisheye) {
+        // fast check erroneously fails with high distortions like fisheye
+        chessBoardFlags |= CALIB_CB_FAST_CHECK;
+    }
+
+    switch( s.calibrationPattern ) // Find feature points on the input format
+    {
+    case Settings::CHESSBOARD:
+        found = findChessboardDownscaled( view, s.boardSize, pointBuf, chessBoardFlags);
+        // a small board may only be found at full resolution; a camera
+        // keeps the frame rate instead and tries again on the next frame
+        if (!found && !s.inputCapture.isOpened())
+            found = findChessboardCorners( view, s.boardSize, pointBuf, chessBoardFlags);
+        break;
+    case Settings::CIRCLES_GRID:
+        found = findCirclesGrid( view, s.boardSize, pointBuf );
+        break;
+    case Settings::ASYMMETRIC_CIRCLES_GRID:
+        found = findCirclesGrid( view, s.boardSize, pointBuf, CALIB_CB_ASYMMETRIC_GRID );
+        break;
+    default:
+        found = false;
+        break;
+    }
+
+    // improve the found corners' coordinate accuracy for chessboard
+    if( found && s.calibrationPattern == Settings::CHESSBOARD)
+    {
+        Mat viewGray;
+        cvtColor(view, viewGray, COLOR_BGR2GRAY);
+        cornerSubPix( viewGray, pointBuf, Size(11,11),
+            Size(-1,-1), TermCriteria( TermCriteria::EPS+TermCriteria::COUNT, 30, 0.1 ));
+    }
+    return found;
+}
+
+//! [incremental_calibration]
+static const int MIN_VIEWS = 4;                 // before the first estimate
+static const int COVERAGE_GRID = 8;             // cells per side of the frame
+static const int MIN_NEW_CELLS = 2;             // for a view to add coverage
+static const double MIN_VIEW_ANGLE = 10;        // degrees between board orientations
+static const double MIN_VIEW_SHIFT = 0.1;       // of the board distance
+static const double CONVERGED_CHANGE = 0.002;   // relative change of the intrinsics
+static const int WARM_ITERATIONS = 10;          // solver iterations from the last estimate
+
+// Running calibration over the views that are worth keeping. A view is
+// kept when its corners reach cells of the frame no view has covered yet,
+// or when the board is seen in a pose not close to any kept one. Each kept
+// view refines the estimate, starting from the previous one; the estimate
+// has converged when two refinements in a row barely move the intrinsics.
+class IncrementalCalibrator
+{
+public:
+    IncrementalCalibrator(const Settings& s) : s(s), stableRefinements(0)
+    {
+        calcBoardCornerPositions(s.boardSize, s.squareSize, boardCorners, s.calibrationPattern);
+    }
+
+    void reset()
+    {
+        imagePoints.clear();
+        rvecs.clear();
+        tvecs.clear();
+        covered.release();
+        imageSize = Size();
+        cameraMatrix.release();
+        distCoeffs.release();
+        stableRefinements = 0;
+    }
+
+    // True when the view was kept
+    bool add(const vector<Point2f>& corners, Size imageSize)
+    {
+        if (imageSize != this->imageSize)
+        {
+            reset();
+            this->imageSize = imageSize;
+            covered = Mat::zeros(COVERAGE_GRID, COVERAGE_GRID, CV_8U);
+        }
+        if (newCells(corners) < MIN_NEW_CELLS && !newPose(corners))
+            return false;
+
+        imagePoints.push_back(corners);
+        for (size_t i = 0; i < corners.size(); ++i)
+            covered.at<uchar>(cell(corners[i])) = 1;
+        if (imagePoints.size() >= (size_t)MIN_VIEWS)
+            refine();
+        return true;
+    }
+
+    bool hasEstimate() const { return !cameraMatrix.empty(); }
+    bool converged() const { return stableRefinements >= 2; }
+    const vector<vector<Point2f> >& views() const { return imagePoints; }
+    const Mat& camera() const { return cameraMatrix; }
+    const Mat& distortion() const { return distCoeffs; }
+
+private:
+    Point cell(const Point2f& p) const
+    {
+        int x = (int)(p.x * COVERAGE_GRID / imageSize.width);
+        int y = (int)(p.y * COVERAGE_GRID / imageSize.height);
+        return Point(min(max(x, 0), COVERAGE_GRID - 1), min(max(y, 0), COVERAGE_GRID - 1));
+    }
+
+    int newCells(const vector<Point2f>& corners) const
+    {
+        Mat hit = covered.clone();
+        int n = 0;
+        for (size_t i = 0; i < corners.size(); ++i)
+        {
+            uchar& h = hit.at<uchar>(cell(corners[i]));
+            n += !h;
+            h = 1;
+        }
+        return n;
+    }
+
+    // Without an estimate there is no pose: only coverage counts
+    bool newPose(const vector<Point2f>& corners) const
+    {
+        if (!hasEstimate())
+            return false;
+
+        // board pose from the corners in normalised camera coordinates
+        vector<Point2f> normalised;
+        if (s.useFisheye)
+            fisheye::undistortPoints(corners, normalised, cameraMatrix, distCoeffs);
+        else
+            undistortPoints(corners, normalised, cameraMatrix, distCoeffs);
+        Mat rvec, tvec;
+        if (!solvePnP(boardCorners, normalised, Mat::eye(3, 3, CV_64F), noArray(), rvec, tvec))
+            return false;
+
+        Mat R;
+        Rodrigues(rvec, R);
+        for (size_t i = 0; i < rvecs.size(); ++i)
+        {
+            Mat Ri, relative;
+            Rodrigues(rvecs[i], Ri);
+            Rodrigues(Ri.t() * R, relative);
+            double angle = norm(relative) * 180 / CV_PI;
+            double shift = norm(tvec, tvecs[i]) / norm(tvecs[i]);
+            if (angle < MIN_VIEW_ANGLE && shift < MIN_VIEW_SHIFT)
+                return false;
+        }
+        return true;
+    }
+
+    void refine()
+    {
+        int flag = s.flag;
+        TermCriteria criteria(TermCriteria::COUNT + TermCriteria::EPS, 30, DBL_EPSILON);
+        Mat previous;
+        if (hasEstimate())
+        {
+            flag |= s.useFisheye ? (int)fisheye::CALIB_USE_INTRINSIC_GUESS : (int)CALIB_USE_INTRINSIC_GUESS;
+            criteria.maxCount = WARM_ITERATIONS;
+            previous = cameraMatrix.clone();
+        }
+        else
+        {
+            cameraMatrix = Mat::eye(3, 3, CV_64F);
+            if( s.flag & CALIB_FIX_ASPECT_RATIO )
+                cameraMatrix.at<double>(0,0) = s.aspectRatio;
+            distCoeffs = Mat::zeros(s.useFisheye ? 4 : 8, 1, CV_64F);
+        }
+
+        vector<vector<Point3f> > objectPoints(imagePoints.size(), boardCorners);
+        rvecs.clear();
+        tvecs.clear();
+        if (s.useFisheye)
+        {
+            Mat _rvecs, _tvecs;
+            fisheye::calibrate(objectPoints, imagePoints, imageSize, cameraMatrix, distCoeffs, _rvecs,
+                               _tvecs, flag, criteria);
+            for (int i = 0; i < _rvecs.rows; ++i)
+            {
+                rvecs.push_back(_rvecs.row(i).reshape(1, 3));
+                tvecs.push_back(_tvecs.row(i).reshape(1, 3));
+            }
+        }
+        else
+            calibrateCamera(objectPoints, imagePoints, imageSize, cameraMatrix, distCoeffs, rvecs, tvecs,
+                            flag, criteria);
+
+        if (previous.empty())
+            return;
+        // fx, fy, cx and cy, relative to the focal length
+        double change = 0;
+        double f = std::abs(previous.at<double>(0,0));
+        const int at[4][2] = { {0,0}, {1,1}, {0,2}, {1,2} };
+        for (int i = 0; i < 4; ++i)
+            change = max(change, std::abs(cameraMatrix.at<double>(at[i][0], at[i][1])
+                                          - previous.at<double>(at[i][0], at[i][1])) / f);
+        stableRefinements = change < CONVERGED_CHANGE ? stableRefinements + 1 : 0;
+    }
+
+    const Settings& s;
+    vector<Point3f> boardCorners;
+    Size imageSize;
+    vector<vector<Point2f> > imagePoints;
+    vector<Mat> rvecs, tvecs;
+    Mat covered;                                // cells of the frame reached by a corner
+    Mat cameraMatrix, distCoeffs;
+    int stableRefinements;
+};
+//! [incremental_calibration]
+
+//! [batch_detection]
+// Batch mode for image lists: every image is decoded and searched by a
+// worker of the OpenCV thread pool, one image per task, and the results
+// are stored by index so that they come back in the order of the list
+class DetectPatterns : public ParallelLoopBody
+{
+public:
+    DetectPatterns(const Settings& s, vector<vector<Point2f> >& points, vector<uchar>& found,
+                   vector<Size>& sizes)
+        : s(s), points(points), found(found), sizes(sizes) {}
+
+    void operator()(const Range& range) const
+    {
+        for (int i = range.start; i < range.end; ++i)
+        {
+            Mat view = imread(s.imageList[i], IMREAD_COLOR);
+            if (view.empty())
+                continue;
+            sizes[i] = view.size();
+            if( s.flipVertical )    flip( view, view, 0 );
+            found[i] = findPattern(s, view, points[i]);
+        }
+    }
+
+private:
+    const Settings& s;
+    vector<vector<Point2f> >& points;
+    vector<uchar>& found;
+    vector<Size>& sizes;
+};
+
+// Same views as the interactive loop of an image list (the first nrFrames
+// images where the pattern is found), then the calibration
+static int runBatchCalibration(Settings& s, bool incremental)
+{
+    size_t n = s.imageList.size();
+    vector<vector<Point2f> > points(n);
+    vector<uchar> found(n, 0);
+    vector<Size> sizes(n);
+
+    double start = getTickCount();
+    parallel_for_(Range(0, (int)n), DetectPatterns(s, points, found, sizes), (double)n);
+    double seconds = (getTickCount() - start) / getTickFrequency();
+
+    vector<vector<Point2f> > imagePoints;
+    Size imageSize;
+    // the incremental calibration picks its views among all the found ones
+    for (size_t i = 0; i < n && (incremental || imagePoints.size() < (size_t)s.nrFrames); ++i)
+    {
+        if (sizes[i].area() == 0)
+        {
+            cerr << "Could not read " << s.imageList[i] << endl;
+            continue;
+        }
+        if (imageSize.area() == 0)
+            imageSize = sizes[i];
+        if (sizes[i] != imageSize)
+        {
+            cerr << s.imageList[i] << " is not of the size of the first image, skipped" << endl;
+            continue;
+        }
+        if (found[i])
+            imagePoints.push_back(points[i]);
+    }
+    cout << "Pattern found in " << imagePoints.size() << " of " << n << " images, in " << seconds
+         << " s on " << getNumThreads() << " threads" << endl;
+
+    if (imagePoints.empty())
+        return -1;
+    Mat cameraMatrix, distCoeffs;
+    if (!incremental)
+        return runCalibrationAndSave(s, imageSize, cameraMatrix, distCoeffs, imagePoints) ? 0 : -1;
+
+    IncrementalCalibrator calibrator(s);
+    for (size_t i = 0; i < imagePoints.size() && !calibrator.converged()
+                       && calibrator.views().size() < (size_t)s.nrFrames; ++i)
+        calibrator.add(imagePoints[i], imageSize);
+    cout << "Kept " << calibrator.views().size() << " views"
+         << (calibrator.converged() ? ", converged" : "") << endl;
+    calibrator.camera().copyTo(cameraMatrix);
+    calibrator.distortion().copyTo(distCoeffs);
+    return runCalibrationAndSave(s, imageSize, cameraMatrix, distCoeffs, calibrator.views(),
+                                 calibrator.hasEstimate()) ? 0 : -1;
+}
+//! [batch_detection]
+
+//! [board_tracking]
+static const int TRACK_MARGIN = 24;             // pixels around the predicted board
+static const float MAX_BACK_ERROR = 1.0f;       // pixels, forward-backward tracking
+
+// Chessboard corners of a camera followed from frame to frame by pyramidal
+// Lucas-Kanade, inside the box where the motion of the last frame puts the
+// board. Points that cannot be tracked back to where they started lose the
+// board, and the caller searches it again in the whole frame.
+class BoardTracker
+{
+public:
+    BoardTracker() : velocity(0, 0) {}
+
+    bool track(const Mat& gray, vector<Point2f>& corners)
+    {
+        if (prevCorners.empty() || prevGray.size() != gray.size())
+            return false;
+
+        vector<Point2f> predicted(prevCorners.size());
+        for (size_t i = 0; i < prevCorners.size(); ++i)
+            predicted[i] = prevCorners[i] + velocity;
+
+        // both frames are cropped to the same box, with room for the
+        // prediction to be wrong by a quarter of the board
+        Rect box = boundingRect(prevCorners) | boundingRect(predicted);
+        int margin = max(TRACK_MARGIN, max(box.width, box.height) / 4);
+        Rect roi = Rect(box.x - margin, box.y - margin, box.width + 2*margin, box.height + 2*margin)
+                 & Rect(Point(0, 0), gray.size());
+        Point2f origin((float)roi.x, (float)roi.y);
+
+        vector<Point2f> from(prevCorners.size()), to(prevCorners.size());
+        for (size_t i = 0; i < prevCorners.size(); ++i)
+        {
+            from[i] = prevCorners[i] - origin;
+            to[i] = predicted[i] - origin;
+        }
+        vector<uchar> status, backStatus;
+        vector<float> err;
+        vector<Point2f> back = from;
+        TermCriteria criteria(TermCriteria::COUNT + TermCriteria::EPS, 20, 0.03);
+        calcOpticalFlowPyrLK(prevGray(roi), gray(roi), from, to, status, err, Size(21, 21), 3,
+                             criteria, OPTFLOW_USE_INITIAL_FLOW);
+        calcOpticalFlowPyrLK(gray(roi), prevGray(roi), to, back, backStatus, err, Size(21, 21), 3,
+                             criteria, OPTFLOW_USE_INITIAL_FLOW);
+
+        Rect2f inside(0, 0, (float)roi.width, (float)roi.height);
+        for (size_t i = 0; i < from.size(); ++i)
+        {
+            Point2f d = back[i] - from[i];
+            if (!status[i] || !backStatus[i] || d.dot(d) > MAX_BACK_ERROR * MAX_BACK_ERROR
+                || !inside.contains(to[i]))
+            {
+                lose();
+                return false;
+            }
+        }
+
+        corners.resize(to.size());
+        for (size_t i = 0; i < to.size(); ++i)
+            corners[i] = to[i] + origin;
+        cornerSubPix( gray, corners, Size(11,11),
+            Size(-1,-1), TermCriteria( TermCriteria::EPS+TermCriteria::COUNT, 30, 0.1 ));
+
+        Point2f shift(0, 0);
+        for (size_t i = 0; i < corners.size(); ++i)
+            shift += corners[i] - prevCorners[i];
+        velocity = shift * (1.0f / corners.size());
+        prevCorners = corners;
+        gray.copyTo(prevGray);
+        return true;
+    }
+
+    // Start again from corners found by a full search
+    void reset(const Mat& gray, const vector<Point2f>& corners)
+    {
+        gray.copyTo(prevGray);
+        prevCorners = corners;
+        velocity = Point2f(0, 0);
+    }
+
+    void lose()
+    {
+        prevCorners.clear();
+        velocity = Point2f(0, 0);
+    }
+
+private:
+    Mat prevGray;
+    vector<Point2f> prevCorners;
+    Point2f velocity;
+};
+//! [board_tracking]
 
 int main(int argc, char* argv[])
 {
@@ -282,6 +711,30 @@ int main(int argc, char* argv[])
         return -1;
     }
 
+    bool batch = false, trackBoard = false, incremental = false;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (string(argv[i]) == "--batch")
+            batch = true;
+        else if (string(argv[i]) == "--track")
+            trackBoard = true;
+        else if (string(argv[i]) == "--incremental")
+            incremental = true;
+    }
+    if (batch)
+    {
+        if (s.inputType != Settings::IMAGE_LIST)
+        {
+            cout << "The batch mode needs an image list as input." << endl;
+            return -1;
+        }
+        return runBatchCalibration(s, incremental);
+    }
+    // only the corners of a chessboard are refined after tracking
+    trackBoard = trackBoard && s.inputCapture.isOpened() && s.calibrationPattern == Settings::CHESSBOARD;
+    BoardTracker tracker;
+    IncrementalCalibrator calibrator(s);
+
     vector<vector<Point2f> > imagePoints;
     Mat cameraMatrix, distCoeffs;
     Size imageSize;
@@ -299,9 +752,13 @@ int main(int argc, char* argv[])
         view = s.nextImage();
 
         //-----  If no more image, or got enough, then stop calibration and show result -------------
-        if( mode == CAPTURING && imagePoints.size() >= (size_t)s.nrFrames )
+        if( mode == CAPTURING && (imagePoints.size() >= (size_t)s.nrFrames
+                                  || (incremental && calibrator.converged())) )
         {
-          if( runCalibrationAndSave(s, imageSize,  cameraMatrix, distCoeffs, imagePoints))
+          calibrator.camera().copyTo(cameraMatrix);
+          calibrator.distortion().copyTo(distCoeffs);
+          if( runCalibrationAndSave(s, imageSize,  cameraMatrix, distCoeffs, imagePoints,
+                                    incremental && calibrator.hasEstimate()))
               mode = CALIBRATED;
           else
               mode = DETECTION;
@@ -310,7 +767,12 @@ int main(int argc, char* argv[])
         {
             // if calibration threshold was not reached yet, calibrate now
             if( mode != CALIBRATED && !imagePoints.empty() )
-                runCalibrationAndSave(s, imageSize,  cameraMatrix, distCoeffs, imagePoints);
+            {
+                calibrator.camera().copyTo(cameraMatrix);
+                calibrator.distortion().copyTo(distCoeffs);
+                runCalibrationAndSave(s, imageSize,  cameraMatrix, distCoeffs, imagePoints,
+                                      incremental && calibrator.hasEstimate());
+            }
             break;
         }
         //! [get_input]
@@ -322,44 +784,23 @@ int main(int argc, char* argv[])
         vector<Point2f> pointBuf;
 
         bool found;
-
-        int chessBoardFlags = CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE;
-
-        if(!s.useFisheye) {
-            // fast check erroneously fails with high distortions like fisheye
-            chessBoardFlags |= CALIB_CB_FAST_CHECK;
-        }
-
-        switch( s.calibrationPattern ) // Find feature points on the input format
+        if (trackBoard)
         {
-        case Settings::CHESSBOARD:
-            found = findChessboardCorners( view, s.boardSize, pointBuf, chessBoardFlags);
-            break;
-        case Settings::CIRCLES_GRID:
-            found = findCirclesGrid( view, s.boardSize, pointBuf );
-            break;
-        case Settings::ASYMMETRIC_CIRCLES_GRID:
-            found = findCirclesGrid( view, s.boardSize, pointBuf, CALIB_CB_ASYMMETRIC_GRID );
-            break;
-        default:
-            found = false;
-            break;
+            Mat viewGray;
+            cvtColor(view, viewGray, COLOR_BGR2GRAY);
+            found = tracker.track(viewGray, pointBuf);
+            if (!found && (found = findPattern(s, view, pointBuf)))
+                tracker.reset(viewGray, pointBuf);
         }
+        else
+            found = findPattern(s, view, pointBuf);
         //! [find_pattern]
         //! [pattern_found]
         if ( found)                // If done with success,
         {
-              // improve the found corners' coordinate accuracy for chessboard
-                if( s.calibrationPattern == Settings::CHESSBOARD)
-                {
-                    Mat viewGray;
-                    cvtColor(view, viewGray, COLOR_BGR2GRAY);
-                    cornerSubPix( viewGray, pointBuf, Size(11,11),
-                        Size(-1,-1), TermCriteria( TermCriteria::EPS+TermCriteria::COUNT, 30, 0.1 ));
-                }
-
                 if( mode == CAPTURING &&  // For camera only take new samples after delay time
-                    (!s.inputCapture.isOpened() || clock() - prevTimestamp > s.delay*1e-3*CLOCKS_PER_SEC) )
+                    (!s.inputCapture.isOpened() || clock() - prevTimestamp > s.delay*1e-3*CLOCKS_PER_SEC)
+                    && (!incremental || calibrator.add(pointBuf, imageSize)) )
                 {
                     imagePoints.push_back(pointBuf);
                     prevTimestamp = clock();
@@ -417,6 +858,7 @@ int main(int argc, char* argv[])
         {
             mode = CAPTURING;
             imagePoints.clear();
+            calibrator.reset();
         }
         //! [await_input]
     }
@@ -521,17 +963,24 @@ static void calcBoardCornerPositions(Size boardSize, float squareSize, vector<Po
 //! [board_corners]
 static bool runCalibration( Settings& s, Size& imageSize, Mat& cameraMatrix, Mat& distCoeffs,
                             vector<vector<Point2f> > imagePoints, vector<Mat>& rvecs, vector<Mat>& tvecs,
-                            vector<float>& reprojErrs,  double& totalAvgErr)
+                            vector<float>& reprojErrs,  double& totalAvgErr, bool useIntrinsicGuess)
 {
-    //! [fixed_aspect]
-    cameraMatrix = Mat::eye(3, 3, CV_64F);
-    if( s.flag & CALIB_FIX_ASPECT_RATIO )
-        cameraMatrix.at<double>(0,0) = s.aspectRatio;
-    //! [fixed_aspect]
-    if (s.useFisheye) {
-        distCoeffs = Mat::zeros(4, 1, CV_64F);
-    } else {
-        distCoeffs = Mat::zeros(8, 1, CV_64F);
+    // the given matrices are the starting point of the solver
+    int flag = s.flag;
+    if (useIntrinsicGuess)
+        flag |= s.useFisheye ? (int)fisheye::CALIB_USE_INTRINSIC_GUESS : (int)CALIB_USE_INTRINSIC_GUESS;
+    else
+    {
+        //! [fixed_aspect]
+        cameraMatrix = Mat::eye(3, 3, CV_64F);
+        if( s.flag & CALIB_FIX_ASPECT_RATIO )
+            cameraMatrix.at<double>(0,0) = s.aspectRatio;
+        //! [fixed_aspect]
+        if (s.useFisheye) {
+            distCoeffs = Mat::zeros(4, 1, CV_64F);
+        } else {
+            distCoeffs = Mat::zeros(8, 1, CV_64F);
+        }
     }
 
     vector<vector<Point3f> > objectPoints(1);
@@ -545,7 +994,7 @@ static bool runCalibration( Settings& s, Size& imageSize, Mat& cameraMatrix, Mat
     if (s.useFisheye) {
         Mat _rvecs, _tvecs;
         rms = fisheye::calibrate(objectPoints, imagePoints, imageSize, cameraMatrix, distCoeffs, _rvecs,
-                                 _tvecs, s.flag);
+                                 _tvecs, flag);
 
         rvecs.reserve(_rvecs.rows);
         tvecs.reserve(_tvecs.rows);
@@ -555,7 +1004,7 @@ static bool runCalibration( Settings& s, Size& imageSize, Mat& cameraMatrix, Mat
         }
     } else {
         rms = calibrateCamera(objectPoints, imagePoints, imageSize, cameraMatrix, distCoeffs, rvecs, tvecs,
-                              s.flag);
+                              flag);
     }
 
     cout << "Re-projection error reported by calibrateCamera: "<< rms << endl;
@@ -683,14 +1132,14 @@ static void saveCameraParams( Settings& s, Size& imageSize, Mat& cameraMatrix, M
 
 //! [run_and_save]
 bool runCalibrationAndSave(Settings& s, Size imageSize, Mat& cameraMatrix, Mat& distCoeffs,
-                           vector<vector<Point2f> > imagePoints)
+                           vector<vector<Point2f> > imagePoints, bool useIntrinsicGuess)
 {
     vector<Mat> rvecs, tvecs;
     vector<float> reprojErrs;
     double totalAvgErr = 0;
 
     bool ok = runCalibration(s, imageSize, cameraMatrix, distCoeffs, imagePoints, rvecs, tvecs, reprojErrs,
-                             totalAvgErr);
+                             totalAvgErr, useIntrinsicGuess);
     cout << (ok ? "Calibration succeeded" : "Calibration failed")
          << ". avg re projection error = " << totalAvgErr << endl;
 
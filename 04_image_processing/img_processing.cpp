@@ -11,36 +11,25 @@
 #include <atomic>
 #include <unistd.h>
 
-void loadAllParameters(const std::string& filename,
-                       cv::Mat& camera_matrix,
-                       cv::Mat& dist_coeffs,
-                       double& pixel_scale,
-                       cv::Mat& persp_transf)
-{
-  cv::FileStorage fs( filename, cv::FileStorage::READ );
-  if (!fs.isOpened())
-  {
-    throw std::runtime_error("Could not open file " + filename);
-  }
-  fs["camera_matrix"] >> camera_matrix;
-  fs["dist_coeffs"] >> dist_coeffs;
-  fs["pixel_scale"] >> pixel_scale;
-  fs["persp_transf"] >> persp_transf;
-  fs.release();
-}
-
+#include "../final_test/CalibrationBundle.h"
 
 void run()
 {
+  // The bundle written by part122 along with fullCalibration.yml holds the
+  // same parameters, and the undistortion tables for its frame size
   cv::Mat camera_matrix, dist_coeffs, persp_transf;
   double pixel_scale;
-  loadAllParameters("../config/fullCalibration.yml", camera_matrix, dist_coeffs,
-                    pixel_scale, persp_transf);
+  CalibrationBundle bundle;
+  load_arena_calibration("../config/calibration.bundle", "../config/fullCalibration.yml", bundle,
+                         camera_matrix, dist_coeffs, persp_transf, pixel_scale);
 
   std::string filename = "undistored3.jpg";
   cv::Mat img = cv::imread(filename.c_str());
   cv::Mat img_undist, img_warped, concat;
-  cv::undistort(img, img_undist, camera_matrix, dist_coeffs);
+  if (bundle.is_open() && bundle.frame_size() == img.size())
+    cv::remap(img, img_undist, bundle.map1(), bundle.map2(), cv::INTER_LINEAR);
+  else
+    cv::undistort(img, img_undist, camera_matrix, dist_coeffs);
   cv::warpPerspective(img_undist, img_warped, persp_transf, img_undist.size());
   cv::hconcat(img, img_warped, concat);
   cv::resize(concat, concat, cv::Size(1280,512));
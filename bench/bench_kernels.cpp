@@ -0,0 +1,780 @@
+// bench_kernels.cpp:
+// Microbenchmarks of the vision and planning kernels of the arena pipeline,
+// run on the sample images of the repository.
+// Every kernel is timed in batches of calibrated length, and the median of
+// the batches is reported as ns/op together with the throughput and the
+// number of heap allocations per op.
+// Usage: bench_kernels [name_filter] [--csv results.csv]
+
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <tesseract/baseapi.h>
+#include <leptonica/allheaders.h>
+
+#include "../final_test/Arena.h"
+#include "../final_test/ArenaTracker.h"
+#include "../final_test/ArenaSnapshot.h"
+#include "../final_test/CalibrationBundle.h"
+#include "../final_test/BitMask.h"
+#include "../final_test/Blobs.h"
+#include "../final_test/Circles.h"
+#include "../final_test/DigitCache.h"
+#include "../final_test/Dubins.h"
+#include "../final_test/MedianFilter.h"
+#include "../final_test/Morphology.h"
+#include "../final_test/RobotTracker.h"
+#include "../final_test/Segmentation.h"
+#include "../final_test/LatencyStats.h"
+
+// ---------------------------------------------------------------------------
+// Allocation counting.
+// The malloc family is interposed and forwarded to glibc, so that both the
+// C++ containers (operator new) and the OpenCV buffers (cv::fastMalloc) are
+// counted.
+// ---------------------------------------------------------------------------
+static std::atomic<uint64_t> g_alloc_count(0);
+static std::atomic<uint64_t> g_alloc_bytes(0);
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void  __libc_free(void* ptr);
+
+static inline void count_alloc(size_t size)
+{
+  g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void* malloc(size_t size)                { count_alloc(size); return __libc_malloc(size); }
+void* calloc(size_t n, size_t size)      { count_alloc(n*size); return __libc_calloc(n, size); }
+void* realloc(void* ptr, size_t size)    { count_alloc(size); return __libc_realloc(ptr, size); }
+void* memalign(size_t a, size_t size)    { count_alloc(size); return __libc_memalign(a, size); }
+void* aligned_alloc(size_t a, size_t size) { count_alloc(size); return __libc_memalign(a, size); }
+void  free(void* ptr)                    { __libc_free(ptr); }
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+  count_alloc(size);
+  *ptr = __libc_memalign(alignment, size);
+  return *ptr ? 0 : ENOMEM;
+}
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark driver
+// ---------------------------------------------------------------------------
+static const uint64_t MIN_BATCH_NS = 50*1000*1000;  // 50 ms per batch
+static const int      BATCHES      = 5;
+
+// Calibration of the detector benchmarks, the bundle first as in part122
+static const char* CALIBRATION_BUNDLE    = "../config/calibration.bundle";
+static const char* INTRINSIC_CALIBRATION = "../config/intrinsic_calibration.xml";
+static const char* FULL_CALIBRATION      = "../config/fullCalibration.yml";
+
+struct BenchResult
+{
+  std::string name;
+  double ns_per_op;
+  double items_per_s;
+  std::string unit;
+  double allocs_per_op;
+  double bytes_per_op;
+};
+
+static std::string g_filter;
+static std::vector<BenchResult> g_results;
+// Results of the kernels that only return a value, so that they are kept
+static volatile int g_sink;
+
+// items: work done by one op (pixels, paths, digits ...), reported per second
+template<typename F>
+void run_bench(const std::string& name, double items, const std::string& unit, F fn)
+{
+  if (!g_filter.empty() && name.find(g_filter) == std::string::npos) return;
+
+  // warm up caches and lazily allocated buffers, then size the batch
+  fn();
+  uint64_t iterations = 1;
+  for (;;)
+  {
+    uint64_t begin = LatencyStats::now_ns();
+    for (uint64_t i=0; i<iterations; ++i) fn();
+    if (LatencyStats::now_ns() - begin >= MIN_BATCH_NS) break;
+    iterations *= 2;
+  }
+
+  std::vector<double> ns_per_op;
+  uint64_t allocs_begin = g_alloc_count.load(), bytes_begin = g_alloc_bytes.load();
+  for (int b=0; b<BATCHES; ++b)
+  {
+    uint64_t begin = LatencyStats::now_ns();
+    for (uint64_t i=0; i<iterations; ++i) fn();
+    ns_per_op.push_back((double)(LatencyStats::now_ns() - begin) / iterations);
+  }
+  double ops = (double)iterations * BATCHES;
+  std::sort(ns_per_op.begin(), ns_per_op.end());
+
+  BenchResult r;
+  r.name = name;
+  r.ns_per_op = ns_per_op[BATCHES/2];
+  r.items_per_s = items * 1e9 / r.ns_per_op;
+  r.unit = unit;
+  r.allocs_per_op = (g_alloc_count.load() - allocs_begin) / ops;
+  r.bytes_per_op = (g_alloc_bytes.load() - bytes_begin) / ops;
+  g_results.push_back(r);
+
+  std::cout << std::left << std::setw(34) << r.name << std::right << std::fixed
+            << std::setw(14) << std::setprecision(0) << r.ns_per_op
+            << std::setw(12) << std::setprecision(2) << r.items_per_s / 1e6 << " M" << std::left << std::setw(8) << r.unit
+            << std::right << std::setw(10) << std::setprecision(1) << r.allocs_per_op
+            << std::setw(12) << std::setprecision(1) << r.bytes_per_op / 1024 << std::endl;
+}
+
+static void write_csv(const std::string& filename)
+{
+  std::ofstream out(filename.c_str());
+  if (!out.is_open())
+  {
+    throw std::runtime_error("Could not open file " + filename);
+  }
+  out << "name,ns_per_op,items_per_s,unit,allocs_per_op,bytes_per_op\n";
+  for (const BenchResult& r : g_results)
+    out << r.name << "," << r.ns_per_op << "," << r.items_per_s << "," << r.unit << ","
+        << r.allocs_per_op << "," << r.bytes_per_op << "\n";
+}
+
+static cv::Mat load_image(const std::string& filename)
+{
+  cv::Mat img = cv::imread(filename, cv::IMREAD_COLOR);
+  if (img.empty()) {
+    throw std::runtime_error("Failed to open the file " + filename);
+  }
+  return img;
+}
+
+// ---------------------------------------------------------------------------
+// Kernels
+// ---------------------------------------------------------------------------
+struct NamedRange
+{
+  const char* name;
+  cv::Scalar low;
+  cv::Scalar high;
+};
+
+// The thresholds used in part122.cpp and final_test/Map.h
+static const NamedRange MASKS[] = {
+  { "black_border",  cv::Scalar(0, 0, 0),      cv::Scalar(180, 255, 100) },
+  { "blue_gate",     cv::Scalar(100, 50, 55),  cv::Scalar(115, 255, 255) },
+  { "red_low",       cv::Scalar(10, 0, 38),    cv::Scalar(19, 250, 229) },
+  { "red_high",      cv::Scalar(160, 10, 10),  cv::Scalar(179, 255, 255) },
+  { "blue",          cv::Scalar(90, 50, 55),   cv::Scalar(115, 255, 255) },
+  { "green",         cv::Scalar(32, 65, 45),   cv::Scalar(57, 215, 200) },
+  { "green_digits",  cv::Scalar(40, 60, 119),  cv::Scalar(88, 249, 255) },
+  { "map_red_low",   cv::Scalar(0, 85, 175),   cv::Scalar(5, 140, 255) },
+  { "map_red_high",  cv::Scalar(5, 85, 175),   cv::Scalar(180, 140, 255) },
+};
+
+static HsvRange bit_range(const NamedRange& range)
+{
+  HsvRange r;
+  for (int c=0; c<3; ++c)
+  {
+    r.low[c] = range.low[c];
+    r.high[c] = range.high[c];
+  }
+  return r;
+}
+
+// The same masks at one bit per pixel, against their 8-bit counterparts
+static void bench_bit_masks(const std::string& tag, const cv::Mat& hsv)
+{
+  double pixels = hsv.total();
+  BitMask bits, other;
+  cv::Mat mask, mask_low, mask_high, out;
+
+  for (const NamedRange& range : MASKS)
+  {
+    HsvRange r = bit_range(range);
+    run_bench(tag + "/threshold_bits_" + range.name, pixels, "pix/s", [&]() {
+      threshold_hsv(hsv, &r, 1, bits);
+    });
+  }
+
+  // Both halves of the red hue in one pass, instead of inRange x2 + addWeighted
+  HsvRange red[] = { bit_range(MASKS[2]), bit_range(MASKS[3]) };
+  run_bench(tag + "/threshold_bits_red_merged", pixels, "pix/s", [&]() {
+    threshold_hsv(hsv, red, 2, bits);
+  });
+  cv::inRange(hsv, MASKS[2].low, MASKS[2].high, mask_low);
+  cv::inRange(hsv, MASKS[3].low, MASKS[3].high, mask_high);
+  threshold_hsv(hsv, &red[0], 1, other);
+
+  run_bench(tag + "/bitwise_or_8bit", pixels, "pix/s", [&]() {
+    cv::bitwise_or(mask_low, mask_high, out);
+  });
+  run_bench(tag + "/bitwise_or_bits", pixels, "pix/s", [&]() {
+    bits |= other;
+  });
+  run_bench(tag + "/bitwise_not_8bit", pixels, "pix/s", [&]() {
+    cv::bitwise_not(mask_high, out);
+  });
+  run_bench(tag + "/bitwise_not_bits", pixels, "pix/s", [&]() {
+    bits.invert();
+  });
+  run_bench(tag + "/countNonZero_8bit", pixels, "pix/s", [&]() {
+    g_sink = cv::countNonZero(mask_high);
+  });
+  run_bench(tag + "/count_bits", pixels, "pix/s", [&]() {
+    g_sink = bits.count();
+  });
+
+  // Closing of the victim mask
+  cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
+  HsvRange green = bit_range(MASKS[6]);
+  cv::inRange(hsv, MASKS[6].low, MASKS[6].high, mask);
+  threshold_hsv(hsv, &green, 1, bits);
+  run_bench(tag + "/close_3x3_8bit", pixels, "pix/s", [&]() {
+    cv::dilate(mask, out, kernel);
+    cv::erode(out, out, kernel);
+  });
+  run_bench(tag + "/close_3x3_bits", pixels, "pix/s", [&]() {
+    close_rect(bits, other, cv::Size(3, 3));
+  });
+  run_bench(tag + "/bits_to_mat", pixels, "pix/s", [&]() {
+    bits.to_mat(out);
+  });
+}
+
+static void bench_color(const std::string& tag, const cv::Mat& frame)
+{
+  double pixels = frame.total();
+  cv::Mat hsv, mask, mask_low, mask_high, red_mask;
+
+  run_bench(tag + "/cvtColor_BGR2HSV", pixels, "pix/s", [&]() {
+    cv::cvtColor(frame, hsv, cv::COLOR_BGR2HSV);
+  });
+  cv::cvtColor(frame, hsv, cv::COLOR_BGR2HSV);
+
+  for (const NamedRange& range : MASKS)
+  {
+    run_bench(tag + "/inRange_" + range.name, pixels, "pix/s", [&]() {
+      cv::inRange(hsv, range.low, range.high, mask);
+    });
+  }
+
+  cv::inRange(hsv, MASKS[2].low, MASKS[2].high, mask_low);
+  cv::inRange(hsv, MASKS[3].low, MASKS[3].high, mask_high);
+  run_bench(tag + "/addWeighted_red_masks", pixels, "pix/s", [&]() {
+    cv::addWeighted(mask_low, 1.0, mask_high, 1.0, 0.0, red_mask);
+  });
+
+  // findContours does not modify its input since OpenCV 3.2
+  std::vector<std::vector<cv::Point>> contours;
+  cv::addWeighted(mask_low, 1.0, mask_high, 1.0, 0.0, red_mask);
+  run_bench(tag + "/findContours_red", pixels, "pix/s", [&]() {
+    cv::findContours(red_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  });
+  cv::inRange(hsv, MASKS[0].low, MASKS[0].high, mask);
+  run_bench(tag + "/findContours_black_border", pixels, "pix/s", [&]() {
+    cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  });
+
+  bench_bit_masks(tag, hsv);
+}
+
+// Median of the colour frame, 9x9 as in Smoothing.cpp
+static void bench_median(const cv::Mat& frame)
+{
+  cv::Mat out, expected;
+  double pixels = frame.total();
+
+  static const int SIZES[] = { 5, 9, 15, 31 };
+  for (int k : SIZES)
+  {
+    std::string tag = "median_" + std::to_string(k) + "x" + std::to_string(k);
+    cv::medianBlur(frame, expected, k);
+    median_filter(frame, out, k);
+    if (cv::norm(out, expected, cv::NORM_INF) != 0)
+      std::cout << tag << ": median_filter differs from cv::medianBlur" << std::endl;
+
+    run_bench(tag + "/cv_medianBlur", pixels, "pix/s", [&]() {
+      cv::medianBlur(frame, out, k);
+    });
+    run_bench(tag + "/median_filter", pixels, "pix/s", [&]() {
+      median_filter(frame, out, k);
+    });
+  }
+}
+
+// Kernel sizes of the pipeline (3x3, 5x5), of full_example.cpp (9x9) and
+// of the Morphology_1/2 tools (up to 43x43)
+static void bench_morphology(const cv::Mat& frame)
+{
+  cv::Mat hsv, mask, out, expected;
+  cv::cvtColor(frame, hsv, cv::COLOR_BGR2HSV);
+  cv::inRange(hsv, cv::Scalar(0, 0, 0), cv::Scalar(180, 255, 100), mask);
+  double pixels = mask.total();
+
+  static const int SIZES[] = { 3, 5, 9, 21, 43 };
+  for (int k : SIZES)
+  {
+    std::string tag = "morph_" + std::to_string(k) + "x" + std::to_string(k);
+    cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(k, k));
+
+    cv::erode(mask, expected, kernel);
+    erode_rect(mask, out, cv::Size(k, k));
+    if (cv::countNonZero(out != expected) != 0)
+      std::cout << tag << ": erode_rect differs from cv::erode" << std::endl;
+    cv::morphologyEx(mask, expected, cv::MORPH_OPEN, kernel);
+    open_rect(mask, out, cv::Size(k, k));
+    if (cv::countNonZero(out != expected) != 0)
+      std::cout << tag << ": open_rect differs from cv::morphologyEx" << std::endl;
+
+    run_bench(tag + "/cv_erode", pixels, "pix/s", [&]() {
+      cv::erode(mask, out, kernel);
+    });
+    run_bench(tag + "/erode_rect", pixels, "pix/s", [&]() {
+      erode_rect(mask, out, cv::Size(k, k));
+    });
+    run_bench(tag + "/cv_open", pixels, "pix/s", [&]() {
+      cv::morphologyEx(mask, out, cv::MORPH_OPEN, kernel);
+    });
+    run_bench(tag + "/open_rect", pixels, "pix/s", [&]() {
+      open_rect(mask, out, cv::Size(k, k));
+    });
+  }
+}
+
+// Obstacle and victim masks of the top view: the serial stages against the
+// row bands, from one thread up to the number of cores. The bands must give
+// the same masks as the serial stages.
+static void bench_segmentation(const cv::Mat& frame)
+{
+  static const HsvRange RED[] = { bit_range(MASKS[2]), bit_range(MASKS[3]) };
+  static const HsvRange GREEN = bit_range(MASKS[6]);
+  MaskSpec specs[] = { { RED, 2, 1 }, { &GREEN, 1, 3 } };
+  std::vector<MaskSpec> spec_list(specs, specs + 2);
+  double pixels = frame.total();
+
+  cv::Mat hsv, red_mask, green_mask;
+  BitMask bits;
+  auto serial = [&]() {
+    cv::cvtColor(frame, hsv, cv::COLOR_BGR2HSV);
+    threshold_hsv(hsv, RED, 2, bits);
+    bits.to_mat(red_mask);
+    threshold_hsv(hsv, &GREEN, 1, bits);
+    close_rect(bits, bits, cv::Size(3, 3));
+    bits.to_mat(green_mask);
+  };
+  serial();
+  run_bench("segment/serial", pixels, "pix/s", serial);
+
+  std::vector<cv::Mat> masks;
+  // 1, 2, 4, ... threads, and all the cores
+  std::vector<int> counts;
+  for (int t=1; t<cv::getNumberOfCPUs(); t*=2)
+    counts.push_back(t);
+  counts.push_back(cv::getNumberOfCPUs());
+
+  int threads = cv::getNumThreads();
+  for (int t : counts)
+  {
+    cv::setNumThreads(t);
+    std::string tag = "segment/bands_t" + std::to_string(t);
+    segment_masks(frame, spec_list, masks);
+    if (cv::countNonZero(masks[0] != red_mask) != 0 || cv::countNonZero(masks[1] != green_mask) != 0)
+      std::cout << tag << ": row bands differ from the serial masks" << std::endl;
+    run_bench(tag, pixels, "pix/s", [&]() {
+      segment_masks(frame, spec_list, masks);
+    });
+  }
+  cv::setNumThreads(threads);
+}
+
+// Obstacle, gate and victim blobs: one labelling of the class map against
+// findContours + boundingRect + contourArea on every mask
+static void bench_blobs(const cv::Mat& frame)
+{
+  cv::Mat hsv, classes;
+  cv::cvtColor(frame, hsv, cv::COLOR_BGR2HSV);
+  std::vector<cv::Mat> masks(3), red(2);
+  cv::inRange(hsv, MASKS[2].low, MASKS[2].high, red[0]);
+  cv::inRange(hsv, MASKS[3].low, MASKS[3].high, red[1]);
+  cv::bitwise_or(red[0], red[1], masks[0]);
+  cv::inRange(hsv, MASKS[1].low, MASKS[1].high, masks[1]);
+  cv::inRange(hsv, MASKS[6].low, MASKS[6].high, masks[2]);
+  double pixels = hsv.total();
+
+  std::vector<std::vector<cv::Point>> contours;
+  std::vector<cv::Rect> boxes;
+  run_bench("blobs/contours_x3", pixels, "pix/s", [&]() {
+    boxes.clear();
+    for (int i=0; i<masks.size(); ++i)
+    {
+      cv::findContours(masks[i], contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+      for (int j=0; j<contours.size(); ++j)
+        if (cv::contourArea(contours[j]) >= 100) boxes.push_back(cv::boundingRect(contours[j]));
+    }
+  });
+
+  std::vector<Blob> blobs;
+  run_bench("blobs/class_map", pixels, "pix/s", [&]() {
+    class_map(masks, classes);
+  });
+  run_bench("blobs/label_blobs", pixels, "pix/s", [&]() {
+    blobs = label_blobs(classes, 100);
+  });
+  run_bench("blobs/components_with_stats", pixels, "pix/s", [&]() {
+    cv::Mat labels, stats, centroids;
+    for (int i=0; i<masks.size(); ++i)
+      cv::connectedComponentsWithStats(masks[i], labels, stats, centroids, 8);
+  });
+  std::cout << "blobs: " << boxes.size() << " contours, " << blobs.size() << " blobs" << std::endl;
+}
+
+// Victim circles of the c4_digits images: HoughCircles as in
+// circle_detection.cpp against the moments fit of the green blobs
+static void bench_circles(const std::string& tag, const cv::Mat& frame)
+{
+  cv::Mat hsv, green_mask, blurred;
+  cv::cvtColor(frame, hsv, cv::COLOR_BGR2HSV);
+  cv::inRange(hsv, cv::Scalar(45, 10, 10), cv::Scalar(75, 255, 255), green_mask);
+  double pixels = green_mask.total();
+
+  std::vector<cv::Vec3f> hough;
+  std::vector<Circle> circles;
+  run_bench(tag + "/hough_circles", pixels, "pix/s", [&]() {
+    cv::GaussianBlur(green_mask, blurred, cv::Size(3, 3), 1, 1);
+    cv::HoughCircles(blurred, hough, cv::HOUGH_GRADIENT, 1, 30, 50, 30, 0, 0);
+  });
+  run_bench(tag + "/find_circles", pixels, "pix/s", [&]() {
+    circles = find_circles(green_mask);
+  });
+  if (!hough.empty() || !circles.empty())
+    std::cout << tag << ": " << hough.size() << " Hough circles, " << circles.size() << " fitted" << std::endl;
+}
+
+static void bench_geometry(const cv::Mat& frame)
+{
+  double pixels = frame.total();
+  cv::Mat camera_matrix, dist_coeffs, persp_transf;
+  double pixel_scale;
+  {
+    CalibrationBundle calibration;
+    load_arena_calibration(CALIBRATION_BUNDLE, FULL_CALIBRATION, calibration,
+                           camera_matrix, dist_coeffs, persp_transf, pixel_scale);
+  }
+
+  cv::Mat new_camera_matrix = cv::getOptimalNewCameraMatrix(camera_matrix, dist_coeffs, frame.size(), 0);
+  cv::Mat undistorted, unwarped, map1, map2;
+
+  run_bench("undistort", pixels, "pix/s", [&]() {
+    cv::undistort(frame, undistorted, camera_matrix, dist_coeffs, new_camera_matrix);
+  });
+
+  // same result as undistort(), with the maps computed once
+  cv::initUndistortRectifyMap(camera_matrix, dist_coeffs, cv::Mat(), new_camera_matrix,
+                              frame.size(), CV_16SC2, map1, map2);
+  run_bench("remap_precomputed", pixels, "pix/s", [&]() {
+    cv::remap(frame, undistorted, map1, map2, cv::INTER_LINEAR);
+  });
+
+  run_bench("warpPerspective", pixels, "pix/s", [&]() {
+    cv::warpPerspective(undistorted, unwarped, persp_transf, frame.size());
+  });
+
+  // Calibration bundle: mapping it against parsing the XML, then the
+  // undistortion through its tables
+  const std::string bundle_file = "bench_calibration.bundle";
+  CalibrationBundle::write(bundle_file, camera_matrix, dist_coeffs, frame.size(), persp_transf, pixel_scale);
+  CalibrationBundle bundle;
+  run_bench("bundle_open", 1, "ops/s", [&]() {
+    bundle.open(bundle_file);
+  });
+  run_bench("calibration_xml_parse", 1, "ops/s", [&]() {
+    cv::FileStorage fs(INTRINSIC_CALIBRATION, cv::FileStorage::READ);
+    cv::Mat k, d;
+    fs["camera_matrix"] >> k;
+    fs["distortion_coefficients"] >> d;
+  });
+  cv::Mat expected;
+  cv::undistort(frame, expected, camera_matrix, dist_coeffs, new_camera_matrix);
+  run_bench("remap_bundle", pixels, "pix/s", [&]() {
+    cv::remap(frame, undistorted, bundle.map1(), bundle.map2(), cv::INTER_LINEAR);
+  });
+  if (cv::norm(undistorted, expected, cv::NORM_INF) != 0)
+    std::cout << "bundle: remap differs from cv::undistort" << std::endl;
+  bundle.close();
+  std::remove(bundle_file.c_str());
+}
+
+static void bench_digits(const cv::Mat& img)
+{
+  // Same preparation as processNumbers() in part122.cpp, on the first blob
+  cv::Mat hsv_img, green_mask, green_mask_inv;
+  cv::cvtColor(img, hsv_img, cv::COLOR_BGR2HSV);
+  cv::inRange(hsv_img, cv::Scalar(40, 60, 119), cv::Scalar(88, 249, 255), green_mask);
+  close_rect(green_mask, green_mask, cv::Size((1*2) + 1, (1*2)+1));
+
+  std::vector<std::vector<cv::Point>> contours;
+  cv::findContours(green_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  cv::Rect digit_rect;
+  for (int i=0; i<contours.size(); ++i)
+  {
+    if (cv::contourArea(contours[i]) < 100) continue;
+    digit_rect = cv::boundingRect(contours[i]);
+    break;
+  }
+  if (digit_rect.area() == 0) {
+    std::cout << "No digit found, skipping the digit benchmarks" << std::endl;
+    return;
+  }
+
+  cv::Mat filtered(img.rows, img.cols, CV_8UC3, cv::Scalar(255,255,255));
+  cv::bitwise_not(green_mask, green_mask_inv);
+  img.copyTo(filtered, green_mask_inv);
+  cv::Mat roi;
+  cv::resize(filtered(digit_rect), roi, cv::Size(200, 200));
+  cv::threshold(roi, roi, 80, 255, 0);
+
+  cv::Mat templ = load_image("../c4_digits/imgs/template/0.png");
+  cv::resize(templ, templ, cv::Size(150, 150));
+  cv::Mat result;
+  run_bench("matchTemplate_digit", 1, "digit/s", [&]() {
+    cv::matchTemplate(roi, templ, result, cv::TM_CCOEFF);
+  });
+
+  tesseract::TessBaseAPI ocr;
+  ocr.Init(NULL, "eng");
+  ocr.SetPageSegMode(tesseract::PSM_SINGLE_CHAR);
+  ocr.SetVariable("tessedit_char_whitelist", "0123456789");
+  run_bench("tesseract_digit", 1, "digit/s", [&]() {
+    ocr.SetImage(roi.data, roi.cols, roi.rows, 3, roi.step);
+    char* text = ocr.GetUTF8Text();
+    delete [] text;
+  });
+  ocr.End();
+
+  // A victim already read: hash of its image and lookup instead of the OCR
+  DigitCache cache;
+  cache.store(cv::Point2f(0, 0), DigitCache::image_hash(filtered(digit_rect)), 0);
+  run_bench("digit_cache_hit", 1, "digit/s", [&]() {
+    int digit = -1;
+    cache.lookup(cv::Point2f(0, 0), DigitCache::image_hash(filtered(digit_rect)), digit);
+    g_sink = digit;
+  });
+}
+
+static void bench_tracking(const cv::Mat& frame)
+{
+  cv::Mat camera_matrix, dist_coeffs;
+  CalibrationBundle bundle;
+  load_calibration(CALIBRATION_BUNDLE, INTRINSIC_CALIBRATION, bundle, camera_matrix, dist_coeffs);
+
+  ArenaDetector detector(camera_matrix, dist_coeffs);
+  if (bundle.is_open())
+    detector.set_undistort_maps(bundle.new_camera_matrix(), bundle.map1(), bundle.map2());
+  ArenaDetection detection = detector.detect(frame);
+  if (!detection.found) {
+    std::cout << "No arena found, skipping the tracking benchmarks" << std::endl;
+    return;
+  }
+
+  run_bench("arena_detect_full", 1, "frame/s", [&]() {
+    detector.detect(frame);
+  });
+  for (int level=1; level<=2; ++level)
+  {
+    detector.set_pyramid_level(level);
+    run_bench("arena_detect_pyramid_l" + std::to_string(level), 1, "frame/s", [&]() {
+      detector.detect(frame);
+    });
+  }
+  detector.set_pyramid_level(0);
+  run_bench("arena_detect_features", 1, "frame/s", [&]() {
+    g_sink = detector.detect_features(frame).victims.size();
+  });
+
+  // Steady state: nothing moves between the frames
+  ArenaTracker tracker(detector, 1 << 30);
+  tracker.track(frame);
+  run_bench("arena_track_static", 1, "frame/s", [&]() {
+    tracker.track(frame);
+  });
+
+  // One small object appears and disappears in the middle of the arena
+  cv::Mat changed = frame.clone();
+  cv::Point2f center(0, 0);
+  for (int i=0; i<4; ++i)
+    center += 0.25f * cv::Point2f(detection.rectangular_points.at<float>(i,0), detection.rectangular_points.at<float>(i,1));
+  cv::rectangle(changed, cv::Rect(center.x - 20, center.y - 20, 40, 40), cv::Scalar(0,0,200), cv::FILLED);
+  bool odd = false;
+  run_bench("arena_track_small_change", 1, "frame/s", [&]() {
+    tracker.track((odd = !odd) ? changed : frame);
+  });
+
+  // Robot marker: a blue triangle next to the same spot
+  cv::Mat robot_frame = frame.clone();
+  std::vector<cv::Point> triangle = { cv::Point(center.x + 60, center.y - 20),
+                                      cv::Point(center.x + 60, center.y + 20),
+                                      cv::Point(center.x + 120, center.y) };
+  cv::fillConvexPoly(robot_frame, triangle, cv::Scalar(200,80,0));
+  tracker.track(robot_frame);
+  RobotTracker robot;
+  int64_t timestamp = 0;
+  robot.track(robot_frame, tracker.top_view(), timestamp);
+  if (!robot.pose().found) {
+    std::cout << "No robot marker found, skipping the robot benchmarks" << std::endl;
+    return;
+  }
+  run_bench("robot_track_window", 1, "pose/s", [&]() {
+    robot.track(robot_frame, tracker.top_view(), timestamp += 33000000);
+  });
+  run_bench("robot_track_full_search", 1, "pose/s", [&]() {
+    robot.reset();
+    robot.track(robot_frame, tracker.top_view(), timestamp += 33000000);
+  });
+}
+
+// Corners of the arena border on the undistorted frame: the polygon
+// approximation of the mask contour against the fit of its four sides
+static void bench_border(const cv::Mat& frame)
+{
+  cv::Mat camera_matrix, dist_coeffs;
+  CalibrationBundle bundle;
+  load_calibration(CALIBRATION_BUNDLE, INTRINSIC_CALIBRATION, bundle, camera_matrix, dist_coeffs);
+
+  ArenaDetector detector(camera_matrix, dist_coeffs);
+  if (bundle.is_open())
+    detector.set_undistort_maps(bundle.new_camera_matrix(), bundle.map1(), bundle.map2());
+  cv::Mat frame_undist = detector.undistort(frame);
+  cv::Mat hsv, black_mask, gray;
+  cv::cvtColor(frame_undist, hsv, cv::COLOR_BGR2HSV);
+  cv::cvtColor(frame_undist, gray, cv::COLOR_BGR2GRAY);
+  border_mask(hsv, black_mask);
+
+  cv::Mat polygon_points, line_points;
+  std::vector<cv::Point> border;
+  run_bench("border/polygon", 1, "frame/s", [&]() {
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(black_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    border_from_contours(contours, 1, polygon_points, border);
+  });
+  bool found = false;
+  run_bench("border/lines", 1, "frame/s", [&]() {
+    found = fit_border(gray, black_mask, line_points, border);
+  });
+  if (!found)
+    std::cout << "border: no four sides fitted" << std::endl;
+}
+
+// Arena snapshot of part122: the key of a full frame, then the round trip
+// of a detection through the file
+static void bench_snapshot(const cv::Mat& frame)
+{
+  cv::Mat camera_matrix = cv::Mat::eye(3, 3, CV_64F), dist_coeffs = cv::Mat::zeros(5, 1, CV_64F);
+  ColorConfig colors = ColorConfig::defaults();
+  run_bench("snapshot/key", frame.total(), "pix/s", [&]() {
+    g_sink = snapshot_key(frame, camera_matrix, dist_coeffs, colors) & 1;
+  });
+
+  ArenaDetection detection;
+  detection.found = true;
+  detection.rectangular_points = cv::Mat::zeros(4, 2, CV_32F);
+  detection.persp_transf = cv::Mat::eye(3, 3, CV_64F);
+  detection.pixel_scale = 1.46;
+  for (int i=0; i<4; ++i)
+    detection.gate.push_back(cv::Point(10*i, 20*i));
+  for (int i=0; i<8; ++i)
+  {
+    detection.obstacles.push_back(cv::Rect(30*i, 40*i, 50, 60));
+    Victim victim = { cv::Rect(40*i, 30*i, 60, 60), cv::Point2f(40*i + 30, 30*i + 30), i };
+    detection.victims.push_back(victim);
+  }
+
+  uint64_t key = snapshot_key(frame, camera_matrix, dist_coeffs, colors);
+  const std::string filename = "bench_snapshot.bin";
+  run_bench("snapshot/save", 1, "ops/s", [&]() {
+    save_snapshot(filename, key, detection);
+  });
+  ArenaDetection loaded;
+  run_bench("snapshot/load", 1, "ops/s", [&]() {
+    load_snapshot(filename, key, loaded);
+  });
+  if (loaded.victims.size() != detection.victims.size() || loaded.obstacles != detection.obstacles)
+    std::cout << "snapshot: loaded detection differs from the saved one" << std::endl;
+  std::remove(filename.c_str());
+}
+
+static void bench_planning()
+{
+  // dubins() prints its candidates: silence std::cout while it is timed
+  std::cout.flush();
+  std::cout.setstate(std::ios::badbit);
+  run_bench("dubins", 1, "path/s", []() {
+    dubins(0, 0, (((double(-9) / double(2))) * PI), 600, 600, (PI / double(1)), 1);
+  });
+  std::cout.clear();
+
+  arc a1(0, 0, 0, 1, 1.5);
+  arc a2(a1.xf, a1.yf, a1.thf, 0, 600);
+  arc a3(a2.xf, a2.yf, a2.thf, -1, 1.5);
+  run_bench("cut_arc", 3*299, "point/s", [&]() {
+    cut_arc(a1, a2, a3);
+  });
+}
+
+int main(int argc, char* argv[])
+{
+  std::string csv_filename;
+  for (int i=1; i<argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--csv" && i+1 < argc)
+      csv_filename = argv[++i];
+    else
+      g_filter = arg;
+  }
+
+  std::cout << std::left << std::setw(34) << "kernel" << std::right << std::setw(14) << "ns/op"
+            << std::setw(22) << "throughput" << std::setw(10) << "allocs"
+            << std::setw(12) << "KB/op" << std::endl;
+
+  bench_color("final_test_01", load_image("../final_test/01.jpg"));
+  bench_color("map_01", load_image("../map/01.jpg"));
+  bench_morphology(load_image("../final_test/01.jpg"));
+  bench_median(load_image("../final_test/01.jpg"));
+  bench_blobs(load_image("../final_test/01.jpg"));
+  bench_segmentation(load_image("../final_test/01.jpg"));
+  bench_geometry(load_image("../final_test/01.jpg"));
+  bench_digits(load_image("../c4_digits/imgs/img11.jpg"));
+  bench_circles("circles_img1", load_image("../c4_digits/imgs/img1.jpg"));
+  bench_circles("circles_img12", load_image("../c4_digits/imgs/img12.jpg"));
+  bench_circles("circles_img13", load_image("../c4_digits/imgs/img13.jpg"));
+  bench_circles("circles_crop_03", load_image("../c4_digits/imgs/crop_03.jpg"));
+  bench_tracking(load_image("../final_test/01.jpg"));
+  bench_border(load_image("../final_test/02.jpg"));
+  bench_snapshot(load_image("../final_test/01.jpg"));
+  bench_planning();
+
+  if (!csv_filename.empty())
+    write_csv(csv_filename);
+  return 0;
+}
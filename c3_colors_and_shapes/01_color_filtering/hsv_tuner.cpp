@@ -0,0 +1,412 @@
+// hsv_tuner.cpp:
+// Tune the HSV ranges of one colour class of the pipeline over a set of
+// images, and export them to the colour config loaded by part122, Map,
+// live_arena and arena_regression (--colors).
+// The 3D HSV histogram of the whole set is built once, as a summed-volume
+// table: the pixels in any range are then counted with 8 lookups, so the
+// counts and the H-S view follow the trackbars without going back to the
+// pixels. Only the preview of the current image is thresholded, at reduced
+// size.
+// Usage: hsv_tuner <class> <image>... [--config colors.yml]
+// Keys: a adds a range to the class (copy of the current one), d deletes
+// the current range, s saves the config, q quits.
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/highgui.hpp>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "../../final_test/BitMask.h"
+#include "../../final_test/ColorConfig.h"
+
+static const int PREVIEW_WIDTH = 640;
+static const char* PREVIEW_WINDOW = "Preview";
+static const char* HISTOGRAM_WINDOW = "H-S histogram";
+
+// Half-open box of HSV values
+struct HsvBox
+{
+  int low[3], high[3];
+
+  bool empty() const { return low[0] >= high[0] || low[1] >= high[1] || low[2] >= high[2]; }
+};
+
+static HsvBox intersect(const HsvBox& a, const HsvBox& b)
+{
+  HsvBox box;
+  for (int c=0; c<3; ++c)
+  {
+    box.low[c] = std::max(a.low[c], b.low[c]);
+    box.high[c] = std::min(a.high[c], b.high[c]);
+  }
+  return box;
+}
+
+// Boxes of a range, two when its hue wraps around 0
+static void range_boxes(const HsvRange& range, std::vector<HsvBox>& boxes)
+{
+  HsvBox box;
+  for (int c=0; c<3; ++c)
+  {
+    box.low[c] = range.low[c];
+    box.high[c] = range.high[c] + 1;
+  }
+  box.high[0] = std::min(box.high[0], 180);
+  if (range.low[0] <= range.high[0])
+  {
+    boxes.push_back(box);
+    return;
+  }
+  HsvBox upper = box, lower = box;
+  upper.high[0] = 180;
+  lower.low[0] = 0;
+  lower.high[0] = range.high[0] + 1;
+  boxes.push_back(upper);
+  boxes.push_back(lower);
+}
+
+// Summed-volume table of the HSV histogram: entry (h, s, v) holds the
+// pixels with H < h, S < s and V < v
+class HsvHistogram
+{
+  private:
+    static const int H = 180, S = 256, V = 256;
+    std::vector<uint32_t> m_table;
+
+    size_t index(int h, int s, int v) const { return ((size_t)h * (S+1) + s) * (V+1) + v; }
+
+    int64_t union_count(const std::vector<HsvBox>& boxes, int first, const HsvBox& inter, int sign) const;
+
+  public:
+    void build(const std::vector<cv::Mat>& hsv_images);
+
+    int64_t total() const { return m_table[index(H, S, V)]; }
+    int64_t count(const HsvBox& box) const;
+    // Pixels in any of the ranges
+    int64_t count(const std::vector<HsvRange>& ranges) const;
+    // 256x180 CV_32S pixels of each (s, h) cell with v0 <= V < v1
+    void hs_counts(int v0, int v1, cv::Mat& counts) const;
+};
+
+void HsvHistogram::build (const std::vector<cv::Mat>& hsv_images)
+{
+  m_table.assign((size_t)(H+1) * (S+1) * (V+1), 0);
+
+  double pixels = 0;
+  for (int i=0; i<hsv_images.size(); ++i)
+    pixels += hsv_images[i].total();
+  if (pixels >= 4294967296.)
+    throw std::runtime_error("Too many pixels for a 32-bit histogram");
+
+  for (int i=0; i<hsv_images.size(); ++i)
+  {
+    const cv::Mat& hsv = hsv_images[i];
+    for (int y=0; y<hsv.rows; ++y)
+    {
+      const uchar* p = hsv.ptr<uchar>(y);
+      for (int x=0; x<hsv.cols; ++x, p+=3)
+        ++m_table[index(std::min((int)p[0], H-1) + 1, p[1] + 1, p[2] + 1)];
+    }
+  }
+
+  // Prefix sums along v, then s, then h
+  for (int h=1; h<=H; ++h)
+    for (int s=1; s<=S; ++s)
+    {
+      uint32_t* row = &m_table[index(h, s, 0)];
+      for (int v=1; v<=V; ++v)
+        row[v] += row[v-1];
+    }
+  for (int h=1; h<=H; ++h)
+    for (int s=1; s<=S; ++s)
+    {
+      uint32_t* row = &m_table[index(h, s, 0)];
+      const uint32_t* above = &m_table[index(h, s-1, 0)];
+      for (int v=1; v<=V; ++v)
+        row[v] += above[v];
+    }
+  for (int h=1; h<=H; ++h)
+  {
+    uint32_t* plane = &m_table[index(h, 0, 0)];
+    const uint32_t* previous = &m_table[index(h-1, 0, 0)];
+    for (size_t i=0; i<(size_t)(S+1) * (V+1); ++i)
+      plane[i] += previous[i];
+  }
+}
+
+int64_t HsvHistogram::count (const HsvBox& box) const
+{
+  if (box.empty()) return 0;
+  int h0 = box.low[0], h1 = box.high[0];
+  int s0 = box.low[1], s1 = box.high[1];
+  int v0 = box.low[2], v1 = box.high[2];
+  return (int64_t)m_table[index(h1, s1, v1)] - m_table[index(h0, s1, v1)]
+       - m_table[index(h1, s0, v1)] - m_table[index(h1, s1, v0)]
+       + m_table[index(h0, s0, v1)] + m_table[index(h0, s1, v0)]
+       + m_table[index(h1, s0, v0)] - m_table[index(h0, s0, v0)];
+}
+
+// Inclusion-exclusion over the boxes, skipping the empty intersections
+int64_t HsvHistogram::union_count (const std::vector<HsvBox>& boxes, int first,
+                                   const HsvBox& inter, int sign) const
+{
+  int64_t n = 0;
+  for (int i=first; i<boxes.size(); ++i)
+  {
+    HsvBox next = intersect(inter, boxes[i]);
+    if (next.empty()) continue;
+    n += sign * count(next) + union_count(boxes, i+1, next, -sign);
+  }
+  return n;
+}
+
+int64_t HsvHistogram::count (const std::vector<HsvRange>& ranges) const
+{
+  std::vector<HsvBox> boxes;
+  for (int i=0; i<ranges.size(); ++i)
+    range_boxes(ranges[i], boxes);
+  HsvBox all = { { 0, 0, 0 }, { H, S, V } };
+  return union_count(boxes, 0, all, 1);
+}
+
+void HsvHistogram::hs_counts (int v0, int v1, cv::Mat& counts) const
+{
+  // Table of the slab v0 <= V < v1, then differences along h and s
+  cv::Mat slab(H+1, S+1, CV_32S);
+  for (int h=0; h<=H; ++h)
+    for (int s=0; s<=S; ++s)
+      slab.at<int>(h, s) = m_table[index(h, s, v1)] - m_table[index(h, s, v0)];
+
+  counts.create(S, H, CV_32S);
+  for (int s=0; s<S; ++s)
+    for (int h=0; h<H; ++h)
+      counts.at<int>(s, h) = slab.at<int>(h+1, s+1) - slab.at<int>(h, s+1)
+                           - slab.at<int>(h+1, s) + slab.at<int>(h, s);
+}
+
+// Pixels of each (h, s) cell within the V interval of the range, as their
+// own colour with a brightness growing with the log of the count; the
+// range is outlined
+static cv::Mat histogram_view(const HsvHistogram& histogram, const HsvRange& range)
+{
+  cv::Mat counts;
+  histogram.hs_counts(range.low[2], std::max(range.low[2], range.high[2] + 1), counts);
+  counts.convertTo(counts, CV_32F);
+  float max_count = 0;
+  for (int s=0; s<256; ++s)
+  {
+    for (int h=0; h<180; ++h)
+    {
+      counts.at<float>(s, h) = std::log1p(counts.at<float>(s, h));
+      max_count = std::max(max_count, counts.at<float>(s, h));
+    }
+  }
+
+  cv::Mat hsv(256, 180, CV_8UC3), view;
+  for (int s=0; s<256; ++s)
+  {
+    for (int h=0; h<180; ++h)
+    {
+      float n = max_count > 0 ? counts.at<float>(s, h) / max_count : 0;
+      hsv.at<cv::Vec3b>(s, h) = cv::Vec3b(h, s, cv::saturate_cast<uchar>(255 * n));
+    }
+  }
+  cv::cvtColor(hsv, view, cv::COLOR_HSV2BGR);
+  cv::resize(view, view, cv::Size(), 3, 2, cv::INTER_NEAREST);
+
+  std::vector<HsvBox> boxes;
+  range_boxes(range, boxes);
+  for (int i=0; i<boxes.size(); ++i)
+  {
+    cv::Rect box(boxes[i].low[0] * 3, boxes[i].low[1] * 2,
+                 (boxes[i].high[0] - boxes[i].low[0]) * 3, (boxes[i].high[1] - boxes[i].low[1]) * 2);
+    cv::rectangle(view, box, cv::Scalar(255, 255, 255), 1);
+  }
+  return view;
+}
+
+static cv::Mat preview(const cv::Mat& bgr, const cv::Mat& hsv, const std::vector<HsvRange>& ranges)
+{
+  BitMask bits;
+  cv::Mat mask, shown;
+  threshold_hsv(hsv, &ranges[0], ranges.size(), bits);
+  bits.to_mat(mask);
+  shown = bgr * 0.25;
+  bgr.copyTo(shown, mask);
+  return shown;
+}
+
+static bool file_exists(const std::string& filename)
+{
+  std::ifstream file(filename.c_str());
+  return file.good();
+}
+
+static void set_trackbars(const HsvRange& range)
+{
+  cv::setTrackbarPos("Low H", PREVIEW_WINDOW, range.low[0]);
+  cv::setTrackbarPos("High H", PREVIEW_WINDOW, range.high[0]);
+  cv::setTrackbarPos("Low S", PREVIEW_WINDOW, range.low[1]);
+  cv::setTrackbarPos("High S", PREVIEW_WINDOW, range.high[1]);
+  cv::setTrackbarPos("Low V", PREVIEW_WINDOW, range.low[2]);
+  cv::setTrackbarPos("High V", PREVIEW_WINDOW, range.high[2]);
+}
+
+static HsvRange get_trackbars()
+{
+  HsvRange range = { { cv::getTrackbarPos("Low H", PREVIEW_WINDOW),
+                       cv::getTrackbarPos("Low S", PREVIEW_WINDOW),
+                       cv::getTrackbarPos("Low V", PREVIEW_WINDOW) },
+                     { cv::getTrackbarPos("High H", PREVIEW_WINDOW),
+                       cv::getTrackbarPos("High S", PREVIEW_WINDOW),
+                       cv::getTrackbarPos("High V", PREVIEW_WINDOW) } };
+  return range;
+}
+
+static bool same_range(const HsvRange& a, const HsvRange& b)
+{
+  for (int c=0; c<3; ++c)
+    if (a.low[c] != b.low[c] || a.high[c] != b.high[c]) return false;
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 3)
+  {
+    std::cout << "Usage: " << argv[0] << " <class> <image>... [--config colors.yml]" << std::endl;
+    return 0;
+  }
+
+  std::string class_name = argv[1];
+  std::string config_file = "../../config/colors.yml";
+  std::vector<std::string> filenames;
+  for (int i=2; i<argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--config" && i+1 < argc) config_file = argv[++i];
+    else filenames.push_back(arg);
+  }
+
+  ColorConfig colors = ColorConfig::defaults();
+  if (file_exists(config_file))
+    colors.load(config_file);
+  std::vector<HsvRange> ranges;
+  if (colors.has(class_name))
+    ranges = colors.ranges(class_name);
+  else
+  {
+    HsvRange all = { { 0, 0, 0 }, { 180, 255, 255 } };
+    ranges.push_back(all);
+  }
+
+  // Full resolution HSV images for the histogram, reduced ones for the preview
+  std::vector<cv::Mat> hsv_images, small_bgr, small_hsv;
+  for (int i=0; i<filenames.size(); ++i)
+  {
+    cv::Mat bgr = cv::imread(filenames[i], 1), hsv, small;
+    if (bgr.empty())
+      throw std::runtime_error("Failed to open file " + filenames[i]);
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    hsv_images.push_back(hsv);
+
+    double scale = std::min(1., (double)PREVIEW_WIDTH / bgr.cols);
+    cv::resize(bgr, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    small_bgr.push_back(small);
+    cv::cvtColor(small, hsv, cv::COLOR_BGR2HSV);
+    small_hsv.push_back(hsv);
+  }
+
+  double begin = cv::getTickCount();
+  HsvHistogram histogram;
+  histogram.build(hsv_images);
+  hsv_images.clear();
+  std::cout << "Histogram of " << histogram.total() << " pixels built in "
+            << (cv::getTickCount() - begin) * 1000. / cv::getTickFrequency() << " ms" << std::endl;
+
+  cv::namedWindow(PREVIEW_WINDOW, cv::WINDOW_GUI_NORMAL);
+  cv::namedWindow(HISTOGRAM_WINDOW, cv::WINDOW_AUTOSIZE);
+  cv::createTrackbar("Low H", PREVIEW_WINDOW, NULL, 180);
+  cv::createTrackbar("High H", PREVIEW_WINDOW, NULL, 180);
+  cv::createTrackbar("Low S", PREVIEW_WINDOW, NULL, 255);
+  cv::createTrackbar("High S", PREVIEW_WINDOW, NULL, 255);
+  cv::createTrackbar("Low V", PREVIEW_WINDOW, NULL, 255);
+  cv::createTrackbar("High V", PREVIEW_WINDOW, NULL, 255);
+  cv::createTrackbar("Range", PREVIEW_WINDOW, NULL, 7);
+  cv::createTrackbar("Image", PREVIEW_WINDOW, NULL, std::max(0, (int)filenames.size() - 1));
+
+  int current = 0, image = 0;
+  set_trackbars(ranges[current]);
+  bool dirty = true;
+  for (;;)
+  {
+    int key = cv::waitKey(20) & 0xff;
+    if (key == 'q' || key == 27) break;
+
+    if (key == 'a' && ranges.size() < 8)
+    {
+      ranges.push_back(ranges[current]);
+      cv::setTrackbarPos("Range", PREVIEW_WINDOW, ranges.size() - 1);
+    }
+    else if (key == 'd' && ranges.size() > 1)
+    {
+      ranges.erase(ranges.begin() + current);
+      cv::setTrackbarPos("Range", PREVIEW_WINDOW, std::min(current, (int)ranges.size() - 1));
+    }
+    else if (key == 's')
+    {
+      colors.set(class_name, ranges);
+      colors.save(config_file);
+      std::cout << "Saved " << class_name << " to " << config_file << ":" << std::endl;
+      for (int i=0; i<ranges.size(); ++i)
+        std::cout << "  [ " << ranges[i].low[0] << ", " << ranges[i].low[1] << ", " << ranges[i].low[2]
+                  << ", " << ranges[i].high[0] << ", " << ranges[i].high[1] << ", " << ranges[i].high[2]
+                  << " ]" << std::endl;
+    }
+
+    // A new range selected: its values go to the trackbars
+    int selected = std::min(cv::getTrackbarPos("Range", PREVIEW_WINDOW), (int)ranges.size() - 1);
+    if (selected != current)
+    {
+      current = selected;
+      cv::setTrackbarPos("Range", PREVIEW_WINDOW, current);
+      set_trackbars(ranges[current]);
+      dirty = true;
+    }
+    HsvRange range = get_trackbars();
+    if (!same_range(range, ranges[current]))
+    {
+      ranges[current] = range;
+      dirty = true;
+    }
+    int selected_image = cv::getTrackbarPos("Image", PREVIEW_WINDOW);
+    if (selected_image != image)
+    {
+      image = selected_image;
+      dirty = true;
+    }
+    if (!dirty) continue;
+    dirty = false;
+
+    // Counts over the whole set, from the histogram
+    int64_t total = std::max<int64_t>(1, histogram.total());
+    int64_t in_range = histogram.count(std::vector<HsvRange>(1, ranges[current]));
+    int64_t in_class = histogram.count(ranges);
+
+    cv::Mat shown = preview(small_bgr[image], small_hsv[image], ranges);
+    char text[128];
+    std::snprintf(text, sizeof(text), "%s, range %d/%d: %.2f%%, class: %.2f%%", class_name.c_str(),
+                  current + 1, (int)ranges.size(), 100. * in_range / total, 100. * in_class / total);
+    cv::putText(shown, text, cv::Point(10, 25), cv::FONT_HERSHEY_SIMPLEX, 0.6, cv::Scalar(0, 255, 255), 2);
+    cv::imshow(PREVIEW_WINDOW, shown);
+    cv::imshow(HISTOGRAM_WINDOW, histogram_view(histogram, ranges[current]));
+  }
+  return 0;
+}
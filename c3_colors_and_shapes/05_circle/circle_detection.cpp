@@ -1,5 +1,7 @@
 // circle_detection.cpp:
-// Detect circular shapes using Hough transform
+// Detect circular shapes, by fitting circles to the green blobs (moments and
+// roundness test) or, with --hough, using Hough transform
+// Usage: circle_detection [image] [--hough]
 
 #include <opencv2/core.hpp>
 #include <opencv2/videoio.hpp>
@@ -7,16 +9,17 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
 
+#include "../../final_test/Circles.h"
+
 static const int W_0      = 300;
 static const int H_0      = 0;
 static const int OFFSET_W = 10;
 static const int OFFSET_H = 100;
 
 
-void processImage()
+void processImage(const std::string& filename, bool hough)
 {
   // Load image from file
-  std::string filename = "imgs/polygons.png";
   cv::Mat img = cv::imread(filename.c_str());
   if(img.empty()) {
     throw std::runtime_error("Failed to open the file " + filename);
@@ -43,16 +46,35 @@ void processImage()
   // Wait keypress
   cv::waitKey(0);
 
-  // Blur image to improve performance of Hough detector
-  cv::GaussianBlur(green_mask, green_mask, cv::Size(3, 3), 1, 1);
-  std::vector<cv::Vec3f> circles;
-  cv::HoughCircles(green_mask, circles, cv::HOUGH_GRADIENT, 1, 30, 50, 30, 0, 0); // Circle detection using Hough transform
-  std::cout << "CIRCLES: " << circles.size() << std::endl;
-  for( size_t i = 0; i < circles.size(); i++ )
+  int64_t begin = cv::getTickCount();
+  if (hough)
+  {
+    // Blur image to improve performance of Hough detector
+    cv::GaussianBlur(green_mask, green_mask, cv::Size(3, 3), 1, 1);
+    std::vector<cv::Vec3f> circles;
+    cv::HoughCircles(green_mask, circles, cv::HOUGH_GRADIENT, 1, 30, 50, 30, 0, 0); // Circle detection using Hough transform
+    std::cout << "CIRCLES: " << circles.size() << " in "
+              << (cv::getTickCount() - begin) * 1000. / cv::getTickFrequency() << " ms" << std::endl;
+    for( size_t i = 0; i < circles.size(); i++ )
+    {
+         cv::Point center(cvRound(circles[i][0]), cvRound(circles[i][1]));
+         int radius = cvRound(circles[i][2]);
+         cv::circle( img, center, radius, cv::Scalar(0,170,220), 3, cv::LINE_AA, 0 ); // draw the circle outline
+    }
+  }
+  else
   {
-       cv::Point center(cvRound(circles[i][0]), cvRound(circles[i][1]));
-       int radius = cvRound(circles[i][2]);
-       cv::circle( img, center, radius, cv::Scalar(0,170,220), 3, cv::LINE_AA, 0 ); // draw the circle outline
+    std::vector<Circle> circles = find_circles(green_mask);
+    std::cout << "CIRCLES: " << circles.size() << " in "
+              << (cv::getTickCount() - begin) * 1000. / cv::getTickFrequency() << " ms" << std::endl;
+    for( size_t i = 0; i < circles.size(); i++ )
+    {
+         std::cout << "  center " << circles[i].center << " radius " << circles[i].radius
+                   << " confidence " << circles[i].confidence << std::endl;
+         cv::Point center(cvRound(circles[i].center.x), cvRound(circles[i].center.y));
+         int radius = cvRound(circles[i].radius);
+         cv::circle( img, center, radius, cv::Scalar(0,170,220), 3, cv::LINE_AA, 0 ); // draw the circle outline
+    }
   }
 
   cv::imshow("Original", img);
@@ -60,8 +82,16 @@ void processImage()
 
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-  processImage();
+  std::string filename = "imgs/polygons.png";
+  bool hough = false;
+  for (int i=1; i<argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--hough") hough = true;
+    else filename = arg;
+  }
+  processImage(filename, hough);
   return 0;
 }
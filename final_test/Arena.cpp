@@ -0,0 +1,812 @@
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <iostream>
+
+#include <tesseract/baseapi.h>
+#include <leptonica/allheaders.h>
+
+#include "Arena.h"
+#include "BitMask.h"
+#include "ColorConfig.h"
+#include "Blobs.h"
+#include "Pyramid.h"
+#include "Segmentation.h"
+#include "Trace.h"
+#include "LatencyStats.h"
+
+static const double MIN_AREA_SIZE = 100;
+static const int ARENA_CROP_W = 684;
+static const int VICTIM_CLOSE_KSIZE = (1*2) + 1;
+
+static ColorConfig& color_config()
+{
+  static ColorConfig config = ColorConfig::defaults();
+  return config;
+}
+
+void set_color_config(const ColorConfig& config)
+{
+  color_config() = config;
+}
+
+const ColorConfig& get_color_config()
+{
+  return color_config();
+}
+
+static MaskSpec mask_spec(const std::string& name, int close_ksize)
+{
+  const std::vector<HsvRange>& ranges = color_config().ranges(name);
+  MaskSpec spec = { &ranges[0], (int)ranges.size(), close_ksize };
+  return spec;
+}
+
+static void threshold_class(const cv::Mat& hsv_img, const std::string& name, BitMask& bits)
+{
+  const std::vector<HsvRange>& ranges = color_config().ranges(name);
+  threshold_hsv(hsv_img, &ranges[0], ranges.size(), bits);
+}
+
+// Color masks of the arena elements, on an HSV image. The thresholds write
+// straight into bit masks, which are only expanded to 8-bit for the contours.
+// The ranges are the classes of the current colour config, so the two
+// halves of the red hue go through a single pass.
+void border_mask(const cv::Mat& hsv_img, cv::Mat& mask)
+{
+  BitMask bits;
+  threshold_class(hsv_img, "border", bits);
+  bits.to_mat(mask);
+}
+
+void gate_mask(const cv::Mat& hsv_img, cv::Mat& mask)
+{
+  BitMask bits;
+  threshold_class(hsv_img, "gate", bits);
+  bits.to_mat(mask);
+}
+
+void obstacle_mask(const cv::Mat& hsv_img, cv::Mat& mask)
+{
+  BitMask bits;
+  threshold_class(hsv_img, "obstacle", bits);
+  bits.to_mat(mask);
+}
+
+// Green regions, closed with a 3x3 kernel
+void victim_mask(const cv::Mat& hsv_img, cv::Mat& mask)
+{
+  BitMask bits;
+  threshold_class(hsv_img, "victim", bits);
+
+  // Apply some filtering
+  close_rect(bits, bits, cv::Size(VICTIM_CLOSE_KSIZE, VICTIM_CLOSE_KSIZE));
+  bits.to_mat(mask);
+}
+
+// Find the black border of the arena and its 4 corners (clockwise from the
+// top-left, as expected by arena_transform): the intersections of the four
+// sides fitted to its edge, or the polygon approximation of its contour
+// when the sides cannot be fitted
+bool find_border(const cv::Mat& img, cv::Mat& rectangular_points, std::vector<cv::Point>& border)
+{
+  std::vector<cv::Mat> masks;
+  {
+    TRACE_SCOPE("border_mask");
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    segment_masks(img, std::vector<MaskSpec>(1, mask_spec("border", 1)), masks);
+  }
+  const cv::Mat& black_mask = masks[0];
+
+  {
+    TRACE_SCOPE("border_lines");
+    cv::Mat gray;
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    if (fit_border(gray, black_mask, rectangular_points, border))
+      return true;
+  }
+
+  // Not four clean sides (e.g. the border partly hidden): polygon guess
+  std::vector<std::vector<cv::Point>> contours;
+  {
+    TRACE_SCOPE("border_contours");
+    cv::findContours(black_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE); // find external contours of each blob
+  }
+  return border_from_contours(contours, 1, rectangular_points, border);
+}
+
+// The last large blob approximated by a quadrilateral; scale is the
+// downsampling factor of the image the contours come from
+bool border_from_contours(const std::vector<std::vector<cv::Point>>& contours, int scale,
+                          cv::Mat& rectangular_points, std::vector<cv::Point>& border)
+{
+  std::vector<cv::Point> approx_curve;
+  bool found = false;
+  rectangular_points.create(4, 2, CV_32F);
+  for (int i=0; i<contours.size(); ++i)
+  {
+    if (contours[i].size() <= 200/scale) continue;
+
+    approxPolyDP(contours[i], approx_curve, 20./scale, true);
+    if (approx_curve.size() != 4) continue;
+
+    border = approx_curve;
+    rectangular_points.at<float>(0,0) = approx_curve[0].x;
+    rectangular_points.at<float>(0,1) = approx_curve[0].y;
+
+    rectangular_points.at<float>(1,0) = approx_curve[3].x;
+    rectangular_points.at<float>(1,1) = approx_curve[3].y;
+
+    rectangular_points.at<float>(2,0) = approx_curve[2].x;
+    rectangular_points.at<float>(2,1) = approx_curve[2].y;
+
+    rectangular_points.at<float>(3,0) = approx_curve[1].x;
+    rectangular_points.at<float>(3,1) = approx_curve[1].y;
+    found = true;
+  }
+  return found;
+}
+
+void rotate_corners(cv::Mat& rectangular_points)
+{
+  cv::Mat temp(1,2,CV_32F);
+  rectangular_points.row(0).copyTo(temp.row(0));
+  rectangular_points.row(1).copyTo(rectangular_points.row(0));
+  rectangular_points.row(2).copyTo(rectangular_points.row(1));
+  rectangular_points.row(3).copyTo(rectangular_points.row(2));
+  temp.row(0).copyTo(rectangular_points.row(3));
+}
+
+std::vector<cv::Point> find_gate(const cv::Mat& top_view)
+{
+  TRACE_SCOPE("gate_detection");
+  STAGE_LATENCY(STAGE_SEGMENTATION);
+  // Find blue regions
+  std::vector<cv::Mat> masks;
+  segment_masks(top_view, std::vector<MaskSpec>(1, mask_spec("gate", 1)), masks);
+
+  std::vector<std::vector<cv::Point>> contours;
+  cv::findContours(masks[0], contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  return gate_from_contours(contours, 1);
+}
+
+// The gate is the first blue blob approximated by a quadrilateral; if there
+// is none, the approximation of the last blue blob is returned
+std::vector<cv::Point> gate_from_contours(const std::vector<std::vector<cv::Point>>& contours, int scale)
+{
+  std::vector<cv::Point> approx_curve;
+  for (int i=0; i<contours.size(); ++i)
+  {
+    if (contours[i].size() <= 4/scale) continue;
+
+    approxPolyDP(contours[i], approx_curve, 40./scale, true);
+    if (approx_curve.size() == 4)
+      return approx_curve;
+  }
+  return approx_curve;
+}
+
+// The top view is correctly oriented when the gate lies in the bottom-left
+// corner of the arena
+bool gate_in_corner(const std::vector<cv::Point>& gate, cv::Size size)
+{
+  if (gate.empty()) return false;
+
+  int setvaluex = size.width/4;
+  int setvaluey = size.height/2;
+  for (int i=0; i<gate.size(); ++i)
+  {
+    if (gate[i].x > setvaluex || gate[i].y < setvaluey)
+      return false;
+  }
+  return true;
+}
+
+// Rotates the corners a quarter at a time until the gate of the warped
+// frame is in its corner. After four rotations the corners are back as
+// they were; transf, pixel_scale, top_view and gate are those of the last
+// warp
+int orient_border(const cv::Mat& frame_undist, cv::Mat& corners, cv::Mat& transf,
+                  double& pixel_scale, cv::Mat& top_view, std::vector<cv::Point>& gate)
+{
+  for (int i=0; i<4; ++i)
+  {
+    {
+      TRACE_SCOPE_I("warp_attempt", i);
+      transf = arena_transform(corners, frame_undist.size(), pixel_scale);
+      cv::warpPerspective(frame_undist, top_view, transf, frame_undist.size());
+    }
+
+    gate = find_gate(top_view);
+    if (gate_in_corner(gate, top_view.size()))
+      return i;
+    rotate_corners(corners);
+  }
+  return -1;
+}
+
+// Region of the top view covered by the arena
+cv::Rect arena_crop(cv::Size size)
+{
+  return cv::Rect(0, 0, ARENA_CROP_W, size.height) & cv::Rect(0, 0, size.width, size.height);
+}
+
+// Red obstacles, as bounding boxes of their approximated contours; a box
+// inside a larger one (a piece of the same obstacle split off by a
+// reflection) is dropped
+std::vector<cv::Rect> find_obstacles(const cv::Mat& hsv_img)
+{
+  cv::Mat red_mask;
+  {
+    TRACE_SCOPE("color_masks");
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    obstacle_mask(hsv_img, red_mask);
+  }
+
+  TRACE_SCOPE("red_contours");
+  STAGE_LATENCY(STAGE_OBSTACLES);
+  std::vector<std::vector<cv::Point>> contours;
+  cv::findContours(red_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  return obstacles_from_contours(contours);
+}
+
+std::vector<cv::Rect> obstacles_from_contours(const std::vector<std::vector<cv::Point>>& contours)
+{
+  std::vector<cv::Point> approx_curve;
+  std::vector<cv::Rect> boxes;
+  for (int i=0; i<contours.size(); ++i)
+  {
+    if (cv::contourArea(contours[i]) < MIN_AREA_SIZE) continue; // specks of the floor
+    approxPolyDP(contours[i], approx_curve, 10, true);
+    boxes.push_back(cv::boundingRect(approx_curve));
+  }
+
+  std::vector<cv::Rect> obstacles;
+  for (int i=0; i<boxes.size(); ++i)
+  {
+    bool inside = false;
+    for (int j=0; j<boxes.size() && !inside; ++j)
+      inside = j != i && (boxes[i] & boxes[j]) == boxes[i] && boxes[j].area() > boxes[i].area();
+    if (!inside) obstacles.push_back(boxes[i]);
+  }
+  return obstacles;
+}
+
+// Green victims, as bounding boxes of their approximated contours; the
+// filtered green mask is returned to mask out the circles before the OCR
+std::vector<cv::Rect> find_victims(const cv::Mat& hsv_img, cv::Mat& green_mask)
+{
+  {
+    TRACE_SCOPE("victim_mask");
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    victim_mask(hsv_img, green_mask);
+  }
+
+  TRACE_SCOPE("victim_blobs");
+  return victims_from_blobs(label_blobs(green_mask, MIN_AREA_SIZE));
+}
+
+// Bounding boxes of the blobs, except the ones inside another box (specks
+// in the hole of a digit), as findContours with RETR_EXTERNAL would do
+std::vector<cv::Rect> victims_from_blobs(const std::vector<Blob>& blobs)
+{
+  std::vector<cv::Rect> victims;
+  for (int i=0; i<blobs.size(); ++i)
+  {
+    bool inside = false;
+    for (int j=0; j<blobs.size() && !inside; ++j)
+      inside = j != i && (blobs[i].bbox & blobs[j].bbox) == blobs[i].bbox && blobs[j].area > blobs[i].area;
+    if (!inside) victims.push_back(blobs[i].bbox);
+  }
+  return victims;
+}
+
+std::vector<cv::Rect> victims_from_contours(const std::vector<std::vector<cv::Point>>& contours)
+{
+  std::vector<cv::Point> approx_curve;
+  std::vector<cv::Rect> victims;
+  for (int i=0; i<contours.size(); ++i)
+  {
+    double area = cv::contourArea(contours[i]);
+    if (area < MIN_AREA_SIZE) continue; // filter too small contours to remove false positives
+    approxPolyDP(contours[i], approx_curve, 2, true);
+    victims.push_back(cv::boundingRect(approx_curve)); // find bounding box for each green blob
+  }
+  return victims;
+}
+
+// Copy of the top view with the green circles painted white, so that only
+// the black digits are left for the OCR
+cv::Mat remove_green(const cv::Mat& top_view, const cv::Mat& green_mask)
+{
+  // generate binary mask with inverted pixels w.r.t. green mask -> black numbers are part of this mask
+  cv::Mat green_mask_inv, filtered(top_view.rows, top_view.cols, CV_8UC3, cv::Scalar(255,255,255));
+  cv::bitwise_not(green_mask, green_mask_inv);
+  top_view.copyTo(filtered, green_mask_inv);   // create copy of image without green shapes
+  return filtered;
+}
+
+// Run the OCR on one victim; filtered is the top view with the green
+// circles painted white, so that only the black digit is left
+int recognize_digit(tesseract::TessBaseAPI& ocr, const cv::Mat& filtered, const cv::Rect& bbox)
+{
+  cv::Mat processROI(filtered, bbox); // extract the ROI containing the digit
+  if (processROI.empty()) return -1;
+
+  TRACE_SCOPE("ocr_digit");
+  STAGE_LATENCY(STAGE_OCR);
+  cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size((2*2) + 1, (2*2)+1));
+  cv::resize(processROI, processROI, cv::Size(200, 200)); // resize the ROI
+  cv::threshold( processROI, processROI, 80, 255, 0 ); // threshold and binarize the image, to suppress some noise
+
+  // Apply some additional smoothing and filtering
+  cv::erode(processROI, processROI, kernel);
+  cv::GaussianBlur(processROI, processROI, cv::Size(5, 5), 2, 2);
+  cv::erode(processROI, processROI, kernel);
+
+  // Set image data
+  ocr.SetImage(processROI.data, processROI.cols, processROI.rows, 3, processROI.step);
+
+  // Run Tesseract OCR on image, and keep the first digit of the text
+  char* text = ocr.GetUTF8Text();
+  int digit = -1;
+  for (char* c = text; c != NULL && *c != '\0'; ++c)
+  {
+    if (*c >= '0' && *c <= '9') {
+      digit = *c - '0';
+      break;
+    }
+  }
+  delete [] text;
+  return digit;
+}
+
+
+ArenaDetector::ArenaDetector (const cv::Mat& camera_matrix, const cv::Mat& dist_coeffs)
+  : m_camera_matrix(camera_matrix), m_dist_coeffs(dist_coeffs), m_ocr(new tesseract::TessBaseAPI()),
+    m_pyramid_level(0)
+{
+  TRACE_SCOPE("ocr_init");
+  // Initialize tesseract to use English (eng)
+  m_ocr->Init(NULL, "eng");
+  // Set Page segmentation mode to PSM_SINGLE_CHAR (10)
+  m_ocr->SetPageSegMode(tesseract::PSM_SINGLE_CHAR);
+  // Only digits are valid output characters
+  m_ocr->SetVariable("tessedit_char_whitelist", "0123456789");
+}
+
+ArenaDetector::~ArenaDetector ()
+{
+  m_ocr->End(); // destroy the ocr object (release resources)
+  delete m_ocr;
+}
+
+const cv::Mat& ArenaDetector::new_camera_matrix (cv::Size frame_size)
+{
+  if (frame_size != m_frame_size)
+  {
+    m_frame_size = frame_size;
+    m_new_camera_matrix = cv::getOptimalNewCameraMatrix(m_camera_matrix, m_dist_coeffs, m_frame_size, 0);
+  }
+  return m_new_camera_matrix;
+}
+
+cv::Mat ArenaDetector::undistort (const cv::Mat& frame)
+{
+  TRACE_SCOPE("undistort");
+  STAGE_LATENCY(STAGE_UNDISTORT);
+  cv::Mat frame_undist;
+  if (!m_undistort_map1.empty() && frame.size() == m_undistort_map1.size())
+    cv::remap(frame, frame_undist, m_undistort_map1, m_undistort_map2, cv::INTER_LINEAR);
+  else
+    cv::undistort(frame, frame_undist, m_camera_matrix, m_dist_coeffs, new_camera_matrix(frame.size()));
+  return frame_undist;
+}
+
+void ArenaDetector::set_undistort_maps (const cv::Mat& new_camera_matrix, const cv::Mat& map1, const cv::Mat& map2)
+{
+  m_frame_size = map1.size();
+  m_new_camera_matrix = new_camera_matrix;
+  m_undistort_map1 = map1;
+  m_undistort_map2 = map2;
+}
+
+ArenaDetection ArenaDetector::detect (const cv::Mat& frame)
+{
+  FRAME_LATENCY();
+  return detect_undistorted(undistort(frame));
+}
+
+ArenaDetection ArenaDetector::detect_undistorted (const cv::Mat& frame_undist)
+{
+  FRAME_LATENCY();
+  if (m_pyramid_level > 0)
+    return detect_coarse_to_fine(frame_undist);
+
+  ArenaDetection detection;
+  std::vector<cv::Point> border;
+  if (!find_border(frame_undist, detection.rectangular_points, border))
+    return detection;
+  detection.found = true;
+
+  // Try the 4 orientations of the border until the gate is bottom-left
+  cv::Mat corners = detection.rectangular_points.clone();
+  cv::Mat unwarped_img;
+  detection.orientation = orient_border(frame_undist, corners, detection.persp_transf,
+                                        detection.pixel_scale, unwarped_img, detection.gate);
+  if (detection.orientation >= 0)
+    detection.rectangular_points = corners;
+  else
+  {
+    // No orientation matched: keep the border as it was found
+    detection.orientation = 0;
+    detection.persp_transf = arena_transform(detection.rectangular_points, frame_undist.size(), detection.pixel_scale);
+    cv::warpPerspective(frame_undist, unwarped_img, detection.persp_transf, frame_undist.size());
+    detection.gate = find_gate(unwarped_img);
+  }
+
+  detect_objects(unwarped_img(arena_crop(unwarped_img.size())), detection);
+  return detection;
+}
+
+// Same stages as detect_undistorted(), with the blobs found on the pyramid
+// level and refined at full resolution. The orientation of the border is
+// also searched at that level, so the full frame is warped only once.
+ArenaDetection ArenaDetector::detect_coarse_to_fine (const cv::Mat& frame_undist)
+{
+  int level = m_pyramid_level;
+  int s = ImagePyramid::scale(level);
+  ArenaDetection detection;
+
+  ImagePyramid frame_pyramid;
+  frame_pyramid.build(frame_undist, level);
+
+  std::vector<std::vector<cv::Point>> contours;
+  std::vector<cv::Point> border;
+  cv::Mat coarse_mask;
+  {
+    TRACE_SCOPE("border_mask");
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    border_mask(frame_pyramid.hsv(level), coarse_mask);
+  }
+  cv::findContours(coarse_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  if (!border_from_contours(contours, s, detection.rectangular_points, border))
+    return detection;
+  detection.found = true;
+
+  std::vector<cv::Point2f> corners;
+  for (int i=0; i<4; ++i)
+    corners.push_back(cv::Point2f(detection.rectangular_points.at<float>(i,0) * s,
+                                  detection.rectangular_points.at<float>(i,1) * s));
+  {
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    refine_corners(frame_pyramid, level, border_mask, corners);
+  }
+  for (int i=0; i<4; ++i)
+  {
+    detection.rectangular_points.at<float>(i,0) = corners[i].x;
+    detection.rectangular_points.at<float>(i,1) = corners[i].y;
+  }
+
+  // Orientation: the coarse level is warped with the transformation conjugated
+  // by the scaling, and the gate is looked for in the coarse top view
+  const cv::Mat& coarse_frame = frame_pyramid.bgr(level);
+  cv::Mat to_coarse = (cv::Mat_<double>(3,3) << 1./s, 0., 0., 0., 1./s, 0., 0., 0., 1.);
+  cv::Mat to_full = (cv::Mat_<double>(3,3) << (double)s, 0., 0., 0., (double)s, 0., 0., 0., 1.);
+  cv::Mat corners_mat = detection.rectangular_points.clone();
+  cv::Mat coarse_top, coarse_hsv, blue_mask;
+  for (int i=0; i<4; ++i)
+  {
+    double pixel_scale;
+    cv::Mat transf = arena_transform(corners_mat, frame_undist.size(), pixel_scale);
+    {
+      TRACE_SCOPE_I("warp_attempt", i);
+      cv::warpPerspective(coarse_frame, coarse_top, to_coarse * transf * to_full, coarse_frame.size());
+    }
+    {
+      TRACE_SCOPE("gate_detection");
+      STAGE_LATENCY(STAGE_SEGMENTATION);
+      cv::cvtColor(coarse_top, coarse_hsv, cv::COLOR_BGR2HSV);
+      gate_mask(coarse_hsv, blue_mask);
+      cv::findContours(blue_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    }
+    std::vector<cv::Point> gate = gate_from_contours(contours, s);
+    for (int j=0; j<gate.size(); ++j)
+      gate[j] *= s;
+    if (gate_in_corner(gate, frame_undist.size()))
+    {
+      detection.orientation = i;
+      detection.rectangular_points = corners_mat;
+      detection.persp_transf = transf;
+      detection.pixel_scale = pixel_scale;
+      break;
+    }
+    rotate_corners(corners_mat);
+  }
+
+  // No orientation matched: keep the border as it was found
+  if (detection.persp_transf.empty())
+    detection.persp_transf = arena_transform(detection.rectangular_points, frame_undist.size(), detection.pixel_scale);
+
+  cv::Mat unwarped_img;
+  {
+    TRACE_SCOPE("warp");
+    cv::warpPerspective(frame_undist, unwarped_img, detection.persp_transf, frame_undist.size());
+  }
+  cv::Mat top_view = unwarped_img(arena_crop(unwarped_img.size()));
+
+  ImagePyramid top_pyramid;
+  top_pyramid.build(top_view, level);
+
+  {
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    find_contours_coarse_to_fine(top_pyramid, level, gate_mask, contours);
+  }
+  detection.gate = gate_from_contours(contours, 1);
+
+  {
+    TRACE_SCOPE("red_contours");
+    STAGE_LATENCY(STAGE_OBSTACLES);
+    find_contours_coarse_to_fine(top_pyramid, level, obstacle_mask, contours);
+    detection.obstacles = obstacles_from_contours(contours);
+  }
+
+  cv::Mat green_mask;
+  {
+    TRACE_SCOPE("victim_contours");
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    find_contours_coarse_to_fine(top_pyramid, level, victim_mask, contours, &green_mask);
+  }
+  read_victims(top_view, green_mask, victims_from_contours(contours), detection);
+  return detection;
+}
+
+void ArenaDetector::read_victims (const cv::Mat& top_view, const cv::Mat& green_mask,
+                                  const std::vector<cv::Rect>& boxes, ArenaDetection& detection)
+{
+  cv::Mat filtered = remove_green(top_view, green_mask);
+
+  detection.victims.clear();
+  for (int i=0; i<boxes.size(); ++i)
+  {
+    Victim victim;
+    victim.bbox = boxes[i];
+    victim.center = cv::Point2f(boxes[i].x + boxes[i].width/2.f, boxes[i].y + boxes[i].height/2.f);
+    // No position in the arena without a scale: nothing to key the cache on
+    if (detection.pixel_scale > 0)
+      victim.digit = read_digit(filtered, boxes[i], victim.center * detection.pixel_scale);
+    else
+      victim.digit = ::recognize_digit(*m_ocr, filtered, boxes[i]);
+    detection.victims.push_back(victim);
+  }
+}
+
+void ArenaDetector::detect_objects (const cv::Mat& top_view, ArenaDetection& detection)
+{
+  // Both masks in one pass over the bands of the top view, with the same
+  // thresholds and closing as obstacle_mask and victim_mask
+  std::vector<cv::Mat> masks;
+  {
+    TRACE_SCOPE("color_masks");
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    MaskSpec specs[] = { mask_spec("obstacle", 1), mask_spec("victim", VICTIM_CLOSE_KSIZE) };
+    segment_masks(top_view, std::vector<MaskSpec>(specs, specs + 2), masks);
+  }
+
+  {
+    TRACE_SCOPE("red_contours");
+    STAGE_LATENCY(STAGE_OBSTACLES);
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(masks[0], contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    detection.obstacles = obstacles_from_contours(contours);
+  }
+
+  std::vector<cv::Rect> boxes;
+  {
+    TRACE_SCOPE("victim_blobs");
+    boxes = victims_from_blobs(label_blobs(masks[1], MIN_AREA_SIZE));
+  }
+  read_victims(top_view, masks[1], boxes, detection);
+}
+
+void ArenaDetector::undistort_points (const std::vector<cv::Point2f>& points, cv::Size frame_size,
+                                      std::vector<cv::Point2f>& undistorted)
+{
+  undistorted.clear();
+  if (points.empty()) return;
+  cv::undistortPoints(points, undistorted, m_camera_matrix, m_dist_coeffs, cv::noArray(),
+                      new_camera_matrix(frame_size));
+}
+
+static void project_points(const std::vector<cv::Point2f>& points, const cv::Mat& transf,
+                           std::vector<cv::Point2f>& projected)
+{
+  projected.clear();
+  if (!points.empty())
+    cv::perspectiveTransform(points, projected, transf);
+}
+
+// Window of the top view sampled straight from the raw frame: the
+// undistortion tables of the window alone, rectified by the perspective
+// transformation shifted to its origin
+cv::Mat ArenaDetector::sample_top_view (const cv::Mat& frame, const cv::Mat& persp_transf, const cv::Rect& window)
+{
+  cv::Mat shift = (cv::Mat_<double>(3,3) << 1., 0., -window.x, 0., 1., -window.y, 0., 0., 1.);
+  cv::Mat rectification = shift * persp_transf * new_camera_matrix(frame.size());
+  cv::Mat map1, map2, patch;
+  cv::initUndistortRectifyMap(m_camera_matrix, m_dist_coeffs, rectification, cv::Mat::eye(3, 3, CV_64F),
+                              window.size(), CV_16SC2, map1, map2);
+  cv::remap(frame, patch, map1, map2, cv::INTER_LINEAR);
+  return patch;
+}
+
+// External contours of a mask of the raw frame whose centre falls inside
+// the arena (in top view pixels) once projected
+void ArenaDetector::arena_contours (const cv::Mat& mask, const cv::Mat& persp_transf, const cv::Rect_<float>& arena,
+                                    std::vector<std::vector<cv::Point>>& contours)
+{
+  std::vector<std::vector<cv::Point>> all;
+  cv::findContours(mask, all, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+  std::vector<cv::Point2f> centers, undistorted, projected;
+  for (int i=0; i<all.size(); ++i)
+  {
+    cv::Rect box = cv::boundingRect(all[i]);
+    centers.push_back(cv::Point2f(box.x + box.width/2.f, box.y + box.height/2.f));
+  }
+  undistort_points(centers, mask.size(), undistorted);
+  project_points(undistorted, persp_transf, projected);
+
+  contours.clear();
+  for (int i=0; i<all.size(); ++i)
+    if (arena.contains(projected[i]))
+      contours.push_back(all[i]);
+}
+
+ArenaFeatures ArenaDetector::detect_features (const cv::Mat& frame)
+{
+  FRAME_LATENCY();
+  ArenaFeatures features;
+  cv::Size size = frame.size();
+
+  // All the masks in one pass over the raw frame
+  std::vector<cv::Mat> masks;
+  {
+    TRACE_SCOPE("color_masks");
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    MaskSpec specs[] = { mask_spec("border", 1), mask_spec("gate", 1),
+                         mask_spec("obstacle", 1), mask_spec("victim", VICTIM_CLOSE_KSIZE) };
+    segment_masks(frame, std::vector<MaskSpec>(specs, specs + 4), masks);
+  }
+
+  // The sides of the border are only straight in the undistorted frame: the
+  // points of its outline are undistorted before the lines are fitted
+  {
+    TRACE_SCOPE("border_lines");
+    std::vector<cv::Point> outline, border;
+    if (!border_outline(masks[0], outline))
+      return features;
+    std::vector<cv::Point2f> undistorted;
+    undistort_points(std::vector<cv::Point2f>(outline.begin(), outline.end()), size, undistorted);
+    if (!fit_border_outline(undistorted, cv::Mat(), features.rectangular_points, border))
+      return features;
+  }
+  features.found = true;
+  features.persp_transf = arena_transform(features.rectangular_points, size, features.pixel_scale);
+
+  // Any orientation maps the border to the same rectangle of the top view
+  cv::Rect_<float> arena(0, 0, ARENA_WIDTH_MM / features.pixel_scale, ARENA_HEIGHT_MM / features.pixel_scale);
+  std::vector<std::vector<cv::Point>> contours;
+  std::vector<cv::Point2f> gate, projected;
+  {
+    TRACE_SCOPE("gate_detection");
+    arena_contours(masks[1], features.persp_transf, arena, contours);
+    std::vector<cv::Point> vertices = gate_from_contours(contours, 1);
+    undistort_points(std::vector<cv::Point2f>(vertices.begin(), vertices.end()), size, gate);
+  }
+
+  // Try the 4 orientations of the border until the gate is bottom-left;
+  // only the vertices of the gate are projected
+  cv::Mat corners = features.rectangular_points.clone();
+  for (int i=0; i<4; ++i)
+  {
+    double pixel_scale;
+    cv::Mat transf = arena_transform(corners, size, pixel_scale);
+    project_points(gate, transf, projected);
+    if (gate_in_corner(std::vector<cv::Point>(projected.begin(), projected.end()), size))
+    {
+      features.orientation = i;
+      features.rectangular_points = corners;
+      features.persp_transf = transf;
+      features.pixel_scale = pixel_scale;
+      break;
+    }
+    rotate_corners(corners);
+  }
+
+  // Undistorted frame -> millimetres
+  cv::Mat to_mm = (cv::Mat_<double>(3,3) << features.pixel_scale, 0., 0., 0., features.pixel_scale, 0., 0., 0., 1.);
+  to_mm = to_mm * features.persp_transf;
+  project_points(gate, to_mm, features.gate);
+
+  {
+    TRACE_SCOPE("red_contours");
+    STAGE_LATENCY(STAGE_OBSTACLES);
+    arena_contours(masks[2], features.persp_transf, arena, contours);
+    std::vector<cv::Point> approx_curve;
+    std::vector<cv::Point2f> undistorted;
+    for (int i=0; i<contours.size(); ++i)
+    {
+      if (cv::contourArea(contours[i]) < MIN_AREA_SIZE) continue;
+      approxPolyDP(contours[i], approx_curve, 10, true);
+      undistort_points(std::vector<cv::Point2f>(approx_curve.begin(), approx_curve.end()), size, undistorted);
+      features.obstacles.push_back(std::vector<cv::Point2f>());
+      project_points(undistorted, to_mm, features.obstacles.back());
+    }
+  }
+
+  // Victims: the centroid of each blob, and its box of the top view
+  // resampled on its own for the OCR
+  std::vector<Blob> blobs;
+  std::vector<cv::Rect> boxes;
+  {
+    TRACE_SCOPE("victim_blobs");
+    blobs = label_blobs(masks[3], MIN_AREA_SIZE);
+    boxes = victims_from_blobs(blobs);
+  }
+  for (int i=0; i<blobs.size(); ++i)
+  {
+    const cv::Rect& b = blobs[i].bbox;
+    if (std::find(boxes.begin(), boxes.end(), b) == boxes.end()) continue;
+
+    std::vector<cv::Point2f> points, undistorted;
+    points.push_back(blobs[i].centroid);
+    points.push_back(cv::Point2f(b.x, b.y));
+    points.push_back(cv::Point2f(b.x + b.width, b.y));
+    points.push_back(cv::Point2f(b.x + b.width, b.y + b.height));
+    points.push_back(cv::Point2f(b.x, b.y + b.height));
+    undistort_points(points, size, undistorted);
+    project_points(undistorted, features.persp_transf, projected);
+    if (!arena.contains(projected[0])) continue;
+
+    VictimFeature victim;
+    victim.center = projected[0] * features.pixel_scale;
+    victim.digit = -1;
+    cv::Rect window = cv::boundingRect(std::vector<cv::Point2f>(projected.begin() + 1, projected.end()));
+    if (window.area() > 0)
+    {
+      TRACE_SCOPE("victim_ocr");
+      cv::Mat patch = sample_top_view(frame, features.persp_transf, window), hsv_patch, green_mask;
+      cv::cvtColor(patch, hsv_patch, cv::COLOR_BGR2HSV);
+      victim_mask(hsv_patch, green_mask);
+      victim.digit = read_digit(remove_green(patch, green_mask), cv::Rect(0, 0, window.width, window.height), victim.center);
+    }
+    features.victims.push_back(victim);
+  }
+  return features;
+}
+
+int ArenaDetector::recognize_digit (const cv::Mat& filtered, const cv::Rect& bbox)
+{
+  return ::recognize_digit(*m_ocr, filtered, bbox);
+}
+
+int ArenaDetector::read_digit (const cv::Mat& filtered, const cv::Rect& bbox, cv::Point2f position)
+{
+  cv::Rect r = bbox & cv::Rect(0, 0, filtered.cols, filtered.rows);
+  if (r.area() == 0) return -1;
+
+  uint64_t hash;
+  int digit;
+  {
+    TRACE_SCOPE("digit_cache");
+    hash = DigitCache::image_hash(filtered(r));
+    if (m_digits.lookup(position, hash, digit))
+      return digit;
+  }
+  digit = ::recognize_digit(*m_ocr, filtered, bbox);
+  // a failed read is tried again on the next frame instead of being cached
+  if (digit >= 0)
+    m_digits.store(position, hash, digit);
+  return digit;
+}
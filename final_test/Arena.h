@@ -0,0 +1,167 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+#include "ArenaBorder.h"
+#include "Blobs.h"
+#include "ColorConfig.h"
+#include "DigitCache.h"
+
+namespace tesseract { class TessBaseAPI; }
+
+// Headless version of the arena pipeline of part122.cpp: no window is
+// opened and nothing waits for a key, so the same code runs in the
+// interactive tool, the regression harness and the benchmarks.
+
+struct Victim
+{
+	cv::Rect bbox;        // in the top view
+	cv::Point2f center;
+	int digit;            // -1 when the OCR did not return a digit
+};
+
+struct ArenaDetection
+{
+	bool found;                       // false when no black border was detected
+	cv::Mat rectangular_points;       // 4x2 CV_32F border corners in the undistorted frame
+	int orientation;                  // rotations of the corners needed to bring the gate bottom-left
+	cv::Mat persp_transf;             // undistorted frame -> top view
+	double pixel_scale;               // mm per top view pixel
+	std::vector<cv::Point> gate;      // in the top view
+	std::vector<cv::Rect> obstacles;  // in the top view
+	std::vector<Victim> victims;
+
+	ArenaDetection() : found(false), orientation(0), pixel_scale(0) { }
+};
+
+// Objects of the arena in millimetres from its top-left corner, as seen
+// by detect_features: only their vertices and centroids are projected
+struct VictimFeature
+{
+	cv::Point2f center;   // blob centroid
+	int digit;            // -1 when the OCR did not return a digit
+};
+
+struct ArenaFeatures
+{
+	bool found;
+	cv::Mat rectangular_points;                      // as in ArenaDetection
+	int orientation;
+	cv::Mat persp_transf;
+	double pixel_scale;
+	std::vector<cv::Point2f> gate;                   // vertices
+	std::vector<std::vector<cv::Point2f>> obstacles; // vertices of the approximated contours
+	std::vector<VictimFeature> victims;
+
+	ArenaFeatures() : found(false), orientation(0), pixel_scale(0) { }
+};
+
+// Colour classes used by the masks below ("border", "gate", "obstacle",
+// "victim"), ColorConfig::defaults() until set; set it before running the
+// pipeline, not while it runs
+void set_color_config(const ColorConfig& config);
+const ColorConfig& get_color_config();
+
+// Color masks of the arena elements, on an HSV image
+void border_mask(const cv::Mat& hsv_img, cv::Mat& mask);
+void gate_mask(const cv::Mat& hsv_img, cv::Mat& mask);
+void obstacle_mask(const cv::Mat& hsv_img, cv::Mat& mask);
+void victim_mask(const cv::Mat& hsv_img, cv::Mat& mask);
+
+// Objects from the external contours of a mask; scale is the downsampling
+// factor of the image the contours come from
+bool border_from_contours(const std::vector<std::vector<cv::Point>>& contours, int scale,
+                          cv::Mat& rectangular_points, std::vector<cv::Point>& border);
+std::vector<cv::Point> gate_from_contours(const std::vector<std::vector<cv::Point>>& contours, int scale);
+std::vector<cv::Rect> obstacles_from_contours(const std::vector<std::vector<cv::Point>>& contours);
+std::vector<cv::Rect> victims_from_contours(const std::vector<std::vector<cv::Point>>& contours);
+std::vector<cv::Rect> victims_from_blobs(const std::vector<Blob>& blobs);
+
+// Single stages, shared with the interactive tool
+bool find_border(const cv::Mat& img, cv::Mat& rectangular_points, std::vector<cv::Point>& border);
+void rotate_corners(cv::Mat& rectangular_points);
+std::vector<cv::Point> find_gate(const cv::Mat& top_view);
+bool gate_in_corner(const std::vector<cv::Point>& gate, cv::Size size);
+// Quarter turns of the border corners that bring the gate bottom-left in
+// the top view, with the transform and top view of that orientation; -1
+// when no orientation does, the corners being then unchanged
+int orient_border(const cv::Mat& frame_undist, cv::Mat& corners, cv::Mat& transf,
+                  double& pixel_scale, cv::Mat& top_view, std::vector<cv::Point>& gate);
+cv::Rect arena_crop(cv::Size size);
+std::vector<cv::Rect> find_obstacles(const cv::Mat& hsv_img);
+std::vector<cv::Rect> find_victims(const cv::Mat& hsv_img, cv::Mat& green_mask);
+cv::Mat remove_green(const cv::Mat& top_view, const cv::Mat& green_mask);
+int recognize_digit(tesseract::TessBaseAPI& ocr, const cv::Mat& filtered, const cv::Rect& bbox);
+
+class ArenaDetector
+{
+	private:
+		cv::Mat m_camera_matrix;
+		cv::Mat m_dist_coeffs;
+		cv::Mat m_new_camera_matrix;
+		cv::Size m_frame_size;
+		cv::Mat m_undistort_map1, m_undistort_map2;
+		tesseract::TessBaseAPI* m_ocr;
+		DigitCache m_digits;
+		int m_pyramid_level;
+
+		ArenaDetection detect_coarse_to_fine(const cv::Mat& frame_undist);
+		void read_victims(const cv::Mat& top_view, const cv::Mat& green_mask,
+		                  const std::vector<cv::Rect>& boxes, ArenaDetection& detection);
+		cv::Mat sample_top_view(const cv::Mat& frame, const cv::Mat& persp_transf, const cv::Rect& window);
+		void arena_contours(const cv::Mat& mask, const cv::Mat& persp_transf, const cv::Rect_<float>& arena,
+		                    std::vector<std::vector<cv::Point>>& contours);
+
+	public:
+		ArenaDetector(const cv::Mat& camera_matrix, const cv::Mat& dist_coeffs);
+		~ArenaDetector();
+
+		// 0 runs every stage at full resolution; level l finds the blobs at
+		// 1/2^l of the resolution and refines them at full resolution
+		void set_pyramid_level(int level) { m_pyramid_level = level; }
+
+		cv::Mat undistort(const cv::Mat& frame);
+
+		// Precomputed undistortion of the frames of the maps' size (from a
+		// CalibrationBundle), instead of cv::undistort rebuilding them on
+		// every frame; the result is the same. The maps are not copied:
+		// the bundle must stay open while the detector is used
+		void set_undistort_maps(const cv::Mat& new_camera_matrix, const cv::Mat& map1, const cv::Mat& map2);
+
+		// Camera matrix of the undistorted frames of the given size
+		const cv::Mat& new_camera_matrix(cv::Size frame_size);
+		const cv::Mat& camera_matrix() const { return m_camera_matrix; }
+		const cv::Mat& dist_coeffs() const { return m_dist_coeffs; }
+
+		// Runs every stage on a raw camera frame
+		ArenaDetection detect(const cv::Mat& frame);
+
+		// Stages after the undistortion, for frames that are already undistorted
+		ArenaDetection detect_undistorted(const cv::Mat& frame_undist);
+
+		// Points of a raw frame of the given size moved to the undistorted frame
+		void undistort_points(const std::vector<cv::Point2f>& points, cv::Size frame_size,
+		                      std::vector<cv::Point2f>& undistorted);
+
+		// Same objects as detect(), segmented on the raw frame: only the
+		// vertices of the contours and the centroids of the blobs are
+		// undistorted and projected, and only the victims are resampled,
+		// each in a window of the top view, for the OCR
+		ArenaFeatures detect_features(const cv::Mat& frame);
+
+		// Obstacles, victims and digits of an already cropped top view
+		void detect_objects(const cv::Mat& top_view, ArenaDetection& detection);
+
+		// OCR of one victim of an image returned by remove_green
+		int recognize_digit(const cv::Mat& filtered, const cv::Rect& bbox);
+
+		// Same, through the digit cache: position is the centre of the victim
+		// in arena millimetres, and the OCR only runs when no victim was read
+		// there or its image has changed
+		int read_digit(const cv::Mat& filtered, const cv::Rect& bbox, cv::Point2f position);
+		DigitCache& digit_cache() { return m_digits; }
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "ArenaBorder.h"
+
+static const int MIN_CONTOUR_POINTS = 200;
+static const double QUAD_TOLERANCE = 20;   // pixels, polygon approximation of the outline
+static const int RANSAC_ITERATIONS = 200;
+static const float RANSAC_TOLERANCE = 2;   // pixels from the line
+static const float MIN_SAMPLE_SPAN = 10;   // pixels between the two points of a sample
+static const int EDGE_SAMPLES = 64;        // subpixel edge points per side
+static const int EDGE_SEARCH = 4;          // pixels on both sides of the fitted line
+static const float EDGE_TRIM = 0.1;        // of the side at both ends, away from the corners
+static const float MIN_EDGE_STEP = 4;      // grey levels per pixel
+static const double MIN_SIDE_ANGLE = 30;   // degrees between adjacent sides
+
+// Line through p with unit direction d
+struct BorderLine
+{
+  cv::Point2f p, d;
+};
+
+static float cross(cv::Point2f a, cv::Point2f b)
+{
+  return a.x * b.y - a.y * b.x;
+}
+
+static float distance(const BorderLine& line, cv::Point2f q)
+{
+  return std::abs(cross(q - line.p, line.d));
+}
+
+static BorderLine fit_line(const std::vector<cv::Point2f>& points, int dist_type)
+{
+  cv::Vec4f l;
+  cv::fitLine(points, l, dist_type, 0, 0.01, 0.01);
+  BorderLine line = { cv::Point2f(l[2], l[3]), cv::Point2f(l[0], l[1]) };
+  return line;
+}
+
+static void find_inliers(const std::vector<cv::Point2f>& points, const BorderLine& line,
+                         std::vector<int>& inliers)
+{
+  inliers.clear();
+  for (int i=0; i<points.size(); ++i)
+    if (distance(line, points[i]) < RANSAC_TOLERANCE)
+      inliers.push_back(i);
+}
+
+// Line through the most points, refined by least squares on its inliers
+static bool ransac_line(const std::vector<cv::Point2f>& points, cv::RNG& rng,
+                        BorderLine& line, std::vector<int>& inliers)
+{
+  int n = points.size();
+  if (n < 2) return false;
+
+  int best = 0;
+  for (int it=0; it<RANSAC_ITERATIONS; ++it)
+  {
+    cv::Point2f a = points[rng.uniform(0, n)], b = points[rng.uniform(0, n)];
+    float len = std::sqrt((b - a).dot(b - a));
+    if (len < MIN_SAMPLE_SPAN) continue;
+    BorderLine candidate = { a, (b - a) * (1.f / len) };
+
+    int count = 0;
+    for (int i=0; i<n; ++i)
+      count += distance(candidate, points[i]) < RANSAC_TOLERANCE;
+    if (count > best)
+    {
+      best = count;
+      line = candidate;
+    }
+  }
+  if (best < 2) return false;
+
+  std::vector<cv::Point2f> support;
+  find_inliers(points, line, inliers);
+  for (int i=0; i<inliers.size(); ++i)
+    support.push_back(points[inliers[i]]);
+  line = fit_line(support, cv::DIST_L2);
+  find_inliers(points, line, inliers);
+  return true;
+}
+
+static bool sample(const cv::Mat& gray, cv::Point2f q, float& value)
+{
+  int x = cvFloor(q.x), y = cvFloor(q.y);
+  if (x < 0 || y < 0 || x + 1 >= gray.cols || y + 1 >= gray.rows) return false;
+  float fx = q.x - x, fy = q.y - y;
+  const uchar* r0 = gray.ptr<uchar>(y) + x;
+  const uchar* r1 = gray.ptr<uchar>(y + 1) + x;
+  value = (r0[0] * (1 - fx) + r0[1] * fx) * (1 - fy) + (r1[0] * (1 - fx) + r1[1] * fx) * fy;
+  return true;
+}
+
+// Points of the side at the peak of the gradient across it, interpolated
+// by a parabola, spread over the span [t0, t1] of its inliers
+static void subpixel_edge(const cv::Mat& gray, const BorderLine& line, float t0, float t1,
+                          std::vector<cv::Point2f>& edge)
+{
+  const int n_values = 2 * EDGE_SEARCH + 3;
+  cv::Point2f normal(-line.d.y, line.d.x);
+  edge.clear();
+  for (int k=0; k<EDGE_SAMPLES; ++k)
+  {
+    float t = t0 + (t1 - t0) * (k + 0.5f) / EDGE_SAMPLES;
+    cv::Point2f c = line.p + line.d * t;
+
+    float v[n_values];
+    bool inside = true;
+    for (int j=0; j<n_values && inside; ++j)
+      inside = sample(gray, c + normal * (float)(j - EDGE_SEARCH - 1), v[j]);
+    if (!inside) continue;
+
+    // g[j] is the gradient at offset j - EDGE_SEARCH
+    float g[n_values - 2];
+    int peak = 0;
+    for (int j=0; j<n_values - 2; ++j)
+    {
+      g[j] = std::abs(v[j + 2] - v[j]) / 2;
+      if (g[j] > g[peak]) peak = j;
+    }
+    if (peak == 0 || peak == n_values - 3 || g[peak] < MIN_EDGE_STEP) continue;
+
+    float curvature = g[peak - 1] - 2 * g[peak] + g[peak + 1];
+    float offset = peak - EDGE_SEARCH;
+    if (curvature < 0)
+      offset += 0.5f * (g[peak - 1] - g[peak + 1]) / curvature;
+    edge.push_back(c + normal * offset);
+  }
+}
+
+static bool intersect(const BorderLine& a, const BorderLine& b, cv::Point2f& q)
+{
+  float den = cross(a.d, b.d);
+  if (std::abs(den) < 1e-6) return false;
+  q = a.p + a.d * (cross(b.p - a.p, b.d) / den);
+  return true;
+}
+
+bool border_outline(const cv::Mat& black_mask, std::vector<cv::Point>& outline)
+{
+  // The border is the largest blob whose outline is roughly a quadrilateral;
+  // the dark background around the arena can be larger
+  std::vector<std::vector<cv::Point>> contours;
+  std::vector<cv::Point> approx_curve;
+  cv::findContours(black_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+  int largest = -1;
+  double largest_area = 0;
+  for (int i=0; i<contours.size(); ++i)
+  {
+    if (contours[i].size() < MIN_CONTOUR_POINTS) continue;
+    cv::approxPolyDP(contours[i], approx_curve, QUAD_TOLERANCE, true);
+    if (approx_curve.size() != 4) continue;
+    double area = cv::contourArea(contours[i]);
+    if (area > largest_area)
+    {
+      largest = i;
+      largest_area = area;
+    }
+  }
+  if (largest < 0) return false;
+
+  outline.swap(contours[largest]);
+  return true;
+}
+
+bool fit_border(const cv::Mat& gray, const cv::Mat& black_mask,
+                cv::Mat& rectangular_points, std::vector<cv::Point>& border)
+{
+  std::vector<cv::Point> outline;
+  if (!border_outline(black_mask, outline)) return false;
+  return fit_border_outline(std::vector<cv::Point2f>(outline.begin(), outline.end()), gray,
+                            rectangular_points, border);
+}
+
+bool fit_border_outline(const std::vector<cv::Point2f>& outline, const cv::Mat& gray,
+                        cv::Mat& rectangular_points, std::vector<cv::Point>& border)
+{
+  std::vector<cv::Point2f> points(outline);
+  // Fixed seed: the same frame always gives the same corners
+  cv::RNG rng(0x41524e41);
+  BorderLine sides[4];
+  std::vector<int> inliers;
+  for (int s=0; s<4; ++s)
+  {
+    if (!ransac_line(points, rng, sides[s], inliers)) return false;
+    // each side holds a fair part of the edge, not a bump of the contour
+    if (inliers.size() < outline.size() / 16) return false;
+
+    if (!gray.empty())
+    {
+      float t0 = FLT_MAX, t1 = -FLT_MAX;
+      for (int i=0; i<inliers.size(); ++i)
+      {
+        float t = (points[inliers[i]] - sides[s].p).dot(sides[s].d);
+        t0 = std::min(t0, t);
+        t1 = std::max(t1, t);
+      }
+      float trim = (t1 - t0) * EDGE_TRIM;
+      std::vector<cv::Point2f> edge;
+      subpixel_edge(gray, sides[s], t0 + trim, t1 - trim, edge);
+      if (edge.size() >= EDGE_SAMPLES / 2)
+        sides[s] = fit_line(edge, cv::DIST_HUBER);
+    }
+
+    // the next side is searched among the points left
+    std::vector<cv::Point2f> left;
+    left.reserve(points.size() - inliers.size());
+    for (int i=0, j=0; i<points.size(); ++i)
+    {
+      if (j < inliers.size() && inliers[j] == i) ++j;
+      else left.push_back(points[i]);
+    }
+    points.swap(left);
+  }
+
+  // side 0 and the side most parallel to it are opposite
+  int opposite = 1;
+  for (int s=2; s<4; ++s)
+    if (std::abs(sides[s].d.dot(sides[0].d)) > std::abs(sides[opposite].d.dot(sides[0].d)))
+      opposite = s;
+  int others[2], n_others = 0;
+  for (int s=1; s<4; ++s)
+    if (s != opposite) others[n_others++] = s;
+
+  float min_sin = std::sin(MIN_SIDE_ANGLE * CV_PI / 180);
+  for (int k=0; k<2; ++k)
+    if (std::abs(cross(sides[0].d, sides[others[k]].d)) < min_sin
+        || std::abs(cross(sides[opposite].d, sides[others[k]].d)) < min_sin)
+      return false;
+
+  std::vector<cv::Point2f> corners(4);
+  if (!intersect(sides[0], sides[others[0]], corners[0])
+      || !intersect(sides[0], sides[others[1]], corners[1])
+      || !intersect(sides[opposite], sides[others[1]], corners[2])
+      || !intersect(sides[opposite], sides[others[0]], corners[3]))
+    return false;
+
+  // A corner far out of the outline means two sides barely cross
+  cv::Rect_<float> box = cv::boundingRect(outline);
+  cv::Rect_<float> bounds(box.x - box.width, box.y - box.height, 3 * box.width, 3 * box.height);
+  cv::Point2f center(0, 0);
+  for (int i=0; i<4; ++i)
+  {
+    if (!bounds.contains(corners[i])) return false;
+    center += corners[i] * 0.25f;
+  }
+
+  // Clockwise on screen (y down) is the increasing angle around the center
+  std::vector<std::pair<float, cv::Point2f>> by_angle;
+  for (int i=0; i<4; ++i)
+    by_angle.push_back(std::make_pair(std::atan2(corners[i].y - center.y, corners[i].x - center.x), corners[i]));
+  std::sort(by_angle.begin(), by_angle.end(),
+            [](const std::pair<float, cv::Point2f>& a, const std::pair<float, cv::Point2f>& b)
+            { return a.first < b.first; });
+  int top = 0;
+  for (int i=1; i<4; ++i)
+    if (by_angle[i].second.y < by_angle[top].second.y) top = i;
+
+  rectangular_points.create(4, 2, CV_32F);
+  border.resize(4);
+  for (int i=0; i<4; ++i)
+  {
+    const cv::Point2f& q = by_angle[(top + i) % 4].second;
+    rectangular_points.at<float>(i,0) = q.x;
+    rectangular_points.at<float>(i,1) = q.y;
+    border[i] = cv::Point(cvRound(q.x), cvRound(q.y));
+  }
+  return true;
+}
+
+cv::Mat arena_transform(const cv::Mat& rectangular_points, cv::Size size, double& pixel_scale)
+{
+  float origin_x = 0, origin_y = 0;
+
+  float delta_x = size.width;
+  float delta_y = size.height;
+
+  float scale_x = delta_x/ARENA_WIDTH_MM;
+  float scale_y = delta_y/ARENA_HEIGHT_MM;
+  float scale = std::min(scale_x, scale_y);
+
+  pixel_scale = 1./scale;
+  delta_x = scale*ARENA_WIDTH_MM;
+  delta_y = scale*ARENA_HEIGHT_MM;
+
+  cv::Mat transf_pixels = (cv::Mat_<float>(4,2) << origin_x, origin_y,
+                                                   origin_x+delta_x, origin_y,
+                                                   origin_x+delta_x, origin_y+delta_y,
+                                                   origin_x, origin_y+delta_y);
+
+  return cv::getPerspectiveTransform(rectangular_points, transf_pixels);
+}
@@ -0,0 +1,34 @@
+#ifndef ARENA_BORDER_H
+#define ARENA_BORDER_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+static const double ARENA_WIDTH_MM  = 1000;
+static const double ARENA_HEIGHT_MM = 1500;
+
+// Corners of the black arena border from the four straight sides of its
+// outer edge. The sides are found one after the other by RANSAC on the
+// points of the largest external contour of black_mask, moved to the peak
+// of the intensity gradient of gray at subpixel accuracy, and intersected.
+// The corners go clockwise from the top one, as expected by
+// arena_transform; border gets them rounded. gray may be empty, in which
+// case the sides are fitted to the contour pixels only. False when the
+// edge does not have four sides in two distinct directions.
+bool fit_border(const cv::Mat& gray, const cv::Mat& black_mask,
+                cv::Mat& rectangular_points, std::vector<cv::Point>& border);
+
+// Outer edge of the border: the largest external contour of black_mask
+// whose polygon approximation is a quadrilateral
+bool border_outline(const cv::Mat& black_mask, std::vector<cv::Point>& outline);
+
+// Same fit on the points of an outline already extracted, e.g. undistorted
+// from a contour of the raw frame; gray, if given, is in the same coordinates
+bool fit_border_outline(const std::vector<cv::Point2f>& outline, const cv::Mat& gray,
+                        cv::Mat& rectangular_points, std::vector<cv::Point>& border);
+
+// Perspective transformation from the border corners to a top view of the
+// given size, keeping the 1m x 1.5m aspect ratio of the arena
+cv::Mat arena_transform(const cv::Mat& rectangular_points, cv::Size size, double& pixel_scale);
+
+#endif
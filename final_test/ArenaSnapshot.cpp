@@ -0,0 +1,262 @@
+#include <opencv2/core.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "ArenaSnapshot.h"
+
+static const uint32_t SNAPSHOT_MAGIC = 0x4e534741;  // "AGSN"
+// Bump when the layout of the fields changes
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+// 64-bit hash over 8 bytes at a time; not cryptographic, only meant to
+// tell inputs apart
+class Hasher
+{
+  private:
+    uint64_t m_hash;
+
+    void mix(uint64_t word)
+    {
+      m_hash = (m_hash ^ word) * 0x9e3779b97f4a7c15ULL;
+      m_hash ^= m_hash >> 29;
+    }
+
+  public:
+    Hasher() : m_hash(0xcbf29ce484222325ULL) { }
+
+    void add(const void* data, size_t n)
+    {
+      const uchar* p = (const uchar*)data;
+      for (; n >= 8; p += 8, n -= 8)
+      {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        mix(word);
+      }
+      uint64_t tail = 0;
+      std::memcpy(&tail, p, n);
+      mix(tail ^ ((uint64_t)n << 56));
+    }
+
+    void add(int value) { add(&value, sizeof(value)); }
+
+    // Values only, whatever the type and layout of the matrix
+    void add(const cv::Mat& m)
+    {
+      cv::Mat values;
+      m.convertTo(values, CV_64F);
+      add(values.rows);
+      add(values.cols);
+      for (int y=0; y<values.rows; ++y)
+        add(values.ptr<double>(y), values.cols * values.channels() * sizeof(double));
+    }
+
+    uint64_t hash() const { return m_hash; }
+};
+
+uint64_t snapshot_key(const cv::Mat& frame, const cv::Mat& camera_matrix, const cv::Mat& dist_coeffs,
+                      const ColorConfig& colors)
+{
+  Hasher hasher;
+  hasher.add(SNAPSHOT_VERSION);
+  hasher.add(frame.rows);
+  hasher.add(frame.cols);
+  hasher.add(frame.type());
+  for (int y=0; y<frame.rows; ++y)
+    hasher.add(frame.ptr(y), frame.cols * frame.elemSize());
+
+  hasher.add(camera_matrix);
+  hasher.add(dist_coeffs);
+
+  std::vector<std::string> names = colors.names();
+  for (int i=0; i<names.size(); ++i)
+  {
+    hasher.add(names[i].data(), names[i].size());
+    const std::vector<HsvRange>& ranges = colors.ranges(names[i]);
+    hasher.add(&ranges[0], ranges.size() * sizeof(HsvRange));
+  }
+  return hasher.hash();
+}
+
+// Fields appended to a byte buffer, in the byte order of the host
+class SnapshotWriter
+{
+  private:
+    std::string& m_buffer;
+
+  public:
+    SnapshotWriter(std::string& buffer) : m_buffer(buffer) { }
+
+    template<typename T>
+    void put(const T& value) { m_buffer.append((const char*)&value, sizeof(T)); }
+
+    template<typename T>
+    void put_mat(const cv::Mat& m, int rows, int cols)
+    {
+      put<uint8_t>(!m.empty());
+      if (m.empty()) return;
+      if (m.rows != rows || m.cols != cols || m.type() != cv::DataType<T>::type)
+        throw std::runtime_error("Unexpected matrix in the arena detection");
+      for (int y=0; y<rows; ++y)
+        m_buffer.append((const char*)m.ptr<T>(y), cols * sizeof(T));
+    }
+};
+
+// Reads past the end of the buffer return zeros and clear ok(), so a
+// truncated file is only checked once, at the end
+class SnapshotReader
+{
+  private:
+    const std::string& m_buffer;
+    size_t m_pos;
+    bool m_ok;
+
+  public:
+    SnapshotReader(const std::string& buffer) : m_buffer(buffer), m_pos(0), m_ok(true) { }
+
+    bool ok() const { return m_ok; }
+
+    template<typename T>
+    T get()
+    {
+      if (m_pos + sizeof(T) > m_buffer.size())
+      {
+        m_ok = false;
+        return T();
+      }
+      T value;
+      std::memcpy(&value, m_buffer.data() + m_pos, sizeof(T));
+      m_pos += sizeof(T);
+      return value;
+    }
+
+    template<typename T>
+    cv::Mat get_mat(int rows, int cols)
+    {
+      if (!get<uint8_t>()) return cv::Mat();
+      cv::Mat m(rows, cols, cv::DataType<T>::type);
+      for (int y=0; y<rows; ++y)
+        for (int x=0; x<cols; ++x)
+          m.at<T>(y, x) = get<T>();
+      return m;
+    }
+
+    // Element count of a vector, checked against the bytes left
+    uint32_t get_count(size_t element_size)
+    {
+      uint32_t n = get<uint32_t>();
+      if (n * element_size > m_buffer.size() - m_pos)
+      {
+        m_ok = false;
+        return 0;
+      }
+      return n;
+    }
+};
+
+void save_snapshot(const std::string& filename, uint64_t key, const ArenaDetection& detection)
+{
+  std::string buffer;
+  SnapshotWriter out(buffer);
+  out.put(SNAPSHOT_MAGIC);
+  out.put(SNAPSHOT_VERSION);
+  out.put(key);
+
+  out.put<uint8_t>(detection.found);
+  out.put<int32_t>(detection.orientation);
+  out.put(detection.pixel_scale);
+  out.put_mat<float>(detection.rectangular_points, 4, 2);
+  out.put_mat<double>(detection.persp_transf, 3, 3);
+
+  out.put<uint32_t>(detection.gate.size());
+  for (int i=0; i<detection.gate.size(); ++i)
+  {
+    out.put<int32_t>(detection.gate[i].x);
+    out.put<int32_t>(detection.gate[i].y);
+  }
+
+  out.put<uint32_t>(detection.obstacles.size());
+  for (int i=0; i<detection.obstacles.size(); ++i)
+  {
+    const cv::Rect& r = detection.obstacles[i];
+    out.put<int32_t>(r.x); out.put<int32_t>(r.y); out.put<int32_t>(r.width); out.put<int32_t>(r.height);
+  }
+
+  out.put<uint32_t>(detection.victims.size());
+  for (int i=0; i<detection.victims.size(); ++i)
+  {
+    const Victim& v = detection.victims[i];
+    out.put<int32_t>(v.bbox.x); out.put<int32_t>(v.bbox.y);
+    out.put<int32_t>(v.bbox.width); out.put<int32_t>(v.bbox.height);
+    out.put(v.center.x); out.put(v.center.y);
+    out.put<int32_t>(v.digit);
+  }
+
+  // Written aside and renamed over the old file, so that a crash while
+  // writing never leaves a truncated snapshot
+  std::string tmp_name = filename + ".tmp";
+  std::ofstream file(tmp_name.c_str(), std::ios::binary | std::ios::trunc);
+  file.write(buffer.data(), buffer.size());
+  file.close();
+  if (!file || std::rename(tmp_name.c_str(), filename.c_str()) != 0)
+  {
+    std::remove(tmp_name.c_str());
+    throw std::runtime_error("Could not write file " + filename);
+  }
+}
+
+bool load_snapshot(const std::string& filename, uint64_t key, ArenaDetection& detection)
+{
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (!file) return false;
+  std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  SnapshotReader in(buffer);
+  if (buffer.size() < 16 || in.get<uint32_t>() != SNAPSHOT_MAGIC
+      || in.get<uint32_t>() != SNAPSHOT_VERSION || in.get<uint64_t>() != key)
+    return false;
+
+  ArenaDetection loaded;
+  loaded.found = in.get<uint8_t>();
+  loaded.orientation = in.get<int32_t>();
+  loaded.pixel_scale = in.get<double>();
+  loaded.rectangular_points = in.get_mat<float>(4, 2);
+  loaded.persp_transf = in.get_mat<double>(3, 3);
+
+  uint32_t n = in.get_count(2 * sizeof(int32_t));
+  for (uint32_t i=0; i<n; ++i)
+  {
+    int x = in.get<int32_t>();
+    int y = in.get<int32_t>();
+    loaded.gate.push_back(cv::Point(x, y));
+  }
+
+  n = in.get_count(4 * sizeof(int32_t));
+  for (uint32_t i=0; i<n; ++i)
+  {
+    int x = in.get<int32_t>(), y = in.get<int32_t>();
+    int w = in.get<int32_t>(), h = in.get<int32_t>();
+    loaded.obstacles.push_back(cv::Rect(x, y, w, h));
+  }
+
+  n = in.get_count(5 * sizeof(int32_t) + 2 * sizeof(float));
+  for (uint32_t i=0; i<n; ++i)
+  {
+    Victim v;
+    int x = in.get<int32_t>(), y = in.get<int32_t>();
+    int w = in.get<int32_t>(), h = in.get<int32_t>();
+    v.bbox = cv::Rect(x, y, w, h);
+    float cx = in.get<float>(), cy = in.get<float>();
+    v.center = cv::Point2f(cx, cy);
+    v.digit = in.get<int32_t>();
+    loaded.victims.push_back(v);
+  }
+  if (!in.ok())
+    return false;
+
+  detection = loaded;
+  return true;
+}
@@ -0,0 +1,28 @@
+#ifndef ARENA_SNAPSHOT_H
+#define ARENA_SNAPSHOT_H
+
+#include <opencv2/core.hpp>
+#include <stdint.h>
+#include <string>
+
+#include "Arena.h"
+#include "ColorConfig.h"
+
+// Compact binary file of an arena detection, so that a run on the same
+// input can skip the pipeline. The file starts with a magic number, a
+// format version and the key of the input; the detection follows in
+// fixed-size fields, in the byte order of the machine that wrote it (a
+// file from another byte order fails the magic check and is ignored).
+
+// Hash of everything the detection depends on: the pixels of the raw
+// frame, the calibration and the colour thresholds
+uint64_t snapshot_key(const cv::Mat& frame, const cv::Mat& camera_matrix, const cv::Mat& dist_coeffs,
+                      const ColorConfig& colors);
+
+void save_snapshot(const std::string& filename, uint64_t key, const ArenaDetection& detection);
+
+// False when the file does not exist, holds another key or format
+// version, or is truncated: the caller then runs the detection again
+bool load_snapshot(const std::string& filename, uint64_t key, ArenaDetection& detection);
+
+#endif
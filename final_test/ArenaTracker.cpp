@@ -0,0 +1,227 @@
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "ArenaTracker.h"
+#include "Blobs.h"
+#include "Morphology.h"
+#include "Trace.h"
+#include "LatencyStats.h"
+
+static double iou(const cv::Rect& a, const cv::Rect& b)
+{
+  double inter = (a & b).area();
+  double uni = a.area() + b.area() - inter;
+  return uni > 0 ? inter/uni : 0;
+}
+
+
+ArenaTracker::ArenaTracker (ArenaDetector& detector, int keyframe_interval, double keyframe_change)
+  : m_detector(detector), m_keyframe_interval(keyframe_interval), m_keyframe_change(keyframe_change),
+    m_frames_since_keyframe(0), m_last_keyframe(false), m_drift_corrections(0)
+{ }
+
+const ArenaDetection& ArenaTracker::track (const cv::Mat& frame)
+{
+  FRAME_LATENCY();
+  m_regions.clear();
+  m_last_keyframe = false;
+
+  if (!m_detection.found || frame.size() != m_frame_size
+      || ++m_frames_since_keyframe >= m_keyframe_interval)
+  {
+    keyframe(frame);
+    return m_detection;
+  }
+
+  if (m_drift.check(m_detector, frame))
+  {
+    ++m_drift_corrections;
+    m_detection.rectangular_points = m_drift.corners().clone();
+    m_detection.persp_transf = m_drift.homography()->clone();
+    m_detection.pixel_scale = m_drift.pixel_scale();
+    build_top_view(frame);
+    return m_detection;
+  }
+
+  cv::Mat small, diff_mask;
+  {
+    TRACE_SCOPE("frame_diff");
+    small = small_top_view(frame);
+    cv::absdiff(small, m_reference, diff_mask);
+    cv::threshold(diff_mask, diff_mask, DIFF_THRESHOLD, 255, cv::THRESH_BINARY);
+    dilate_rect(diff_mask, diff_mask, cv::Size(3, 3));
+  }
+
+  double changed = (double)cv::countNonZero(diff_mask) / diff_mask.total();
+  if (changed == 0)
+    return m_detection;
+  if (changed > m_keyframe_change)
+  {
+    keyframe(frame);
+    return m_detection;
+  }
+
+  m_regions = changed_regions(diff_mask);
+  for (int i=0; i<m_regions.size(); ++i)
+  {
+    update_region(frame, m_regions[i]);
+
+    // The region is now up to date: stop reporting it as changed
+    cv::Rect small_region(m_regions[i].x/DIFF_SCALE, m_regions[i].y/DIFF_SCALE,
+                          (m_regions[i].width + DIFF_SCALE-1)/DIFF_SCALE,
+                          (m_regions[i].height + DIFF_SCALE-1)/DIFF_SCALE);
+    small_region &= cv::Rect(0, 0, small.cols, small.rows);
+    small(small_region).copyTo(m_reference(small_region));
+  }
+  return m_detection;
+}
+
+void ArenaTracker::keyframe (const cv::Mat& frame)
+{
+  TRACE_SCOPE("keyframe");
+  m_last_keyframe = true;
+  m_frames_since_keyframe = 0;
+  m_frame_size = frame.size();
+  m_detection = m_detector.detect(frame);
+  if (!m_detection.found) return;
+
+  m_drift.reset(m_detector, frame, m_detection);
+  build_top_view(frame);
+}
+
+void ArenaTracker::build_top_view (const cv::Mat& frame)
+{
+  m_top_view.build(m_detector, m_detection.persp_transf, m_frame_size);
+  m_top_view.decimated(DIFF_SCALE, m_small_map1, m_small_map2);
+  m_reference = small_top_view(frame);
+}
+
+cv::Mat ArenaTracker::small_top_view (const cv::Mat& frame)
+{
+  cv::Mat small, gray;
+  cv::remap(frame, small, m_small_map1, m_small_map2, cv::INTER_LINEAR);
+  cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+  return gray;
+}
+
+// Bounding boxes of the changed blobs in top view pixels, grown by a margin
+// and by the known objects they touch, then merged where they overlap
+std::vector<cv::Rect> ArenaTracker::changed_regions (const cv::Mat& diff_mask)
+{
+  std::vector<Blob> blobs = label_blobs(diff_mask);
+
+  cv::Rect bounds = m_top_view.bounds();
+  std::vector<cv::Rect> known(m_detection.obstacles);
+  for (int i=0; i<m_detection.victims.size(); ++i)
+    known.push_back(m_detection.victims[i].bbox);
+
+  std::vector<cv::Rect> regions;
+  for (int i=0; i<blobs.size(); ++i)
+  {
+    cv::Rect r = blobs[i].bbox;
+    r = cv::Rect(r.x*DIFF_SCALE - REGION_MARGIN, r.y*DIFF_SCALE - REGION_MARGIN,
+                 r.width*DIFF_SCALE + 2*REGION_MARGIN, r.height*DIFF_SCALE + 2*REGION_MARGIN);
+    regions.push_back(r);
+  }
+
+  // Grow and merge until no region touches another one or a known object
+  // only partially: the contours of an object cut by a region border would
+  // be wrong
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (int i=0; i<regions.size(); ++i)
+    {
+      for (int j=0; j<known.size(); ++j)
+      {
+        cv::Rect grown = known[j] + cv::Point(-REGION_MARGIN, -REGION_MARGIN)
+                                  + cv::Size(2*REGION_MARGIN, 2*REGION_MARGIN);
+        if ((regions[i] & grown).area() > 0 && (regions[i] | grown) != regions[i])
+        {
+          regions[i] |= grown;
+          changed = true;
+        }
+      }
+      for (int j=i+1; j<regions.size(); ++j)
+      {
+        if ((regions[i] & regions[j]).area() > 0)
+        {
+          regions[i] |= regions[j];
+          regions.erase(regions.begin() + j);
+          --j;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  for (int i=0; i<regions.size(); ++i)
+    regions[i] &= bounds;
+  return regions;
+}
+
+// Run the segmentation again inside one region of the top view and replace
+// the objects found there; digits are only read for new victims
+void ArenaTracker::update_region (const cv::Mat& frame, const cv::Rect& region)
+{
+  TRACE_SCOPE("region_update");
+  if (region.area() == 0) return;
+
+  cv::Mat patch = m_top_view.sample(frame, region), hsv_patch;
+  {
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    cv::cvtColor(patch, hsv_patch, cv::COLOR_BGR2HSV);
+  }
+
+  std::vector<cv::Rect> obstacles = find_obstacles(hsv_patch);
+  cv::Mat green_mask;
+  std::vector<cv::Rect> boxes = find_victims(hsv_patch, green_mask);
+
+  // Objects of the region are replaced by the new ones
+  std::vector<cv::Rect>& known_obstacles = m_detection.obstacles;
+  for (int i=known_obstacles.size()-1; i>=0; --i)
+  {
+    if ((known_obstacles[i] & region) == known_obstacles[i])
+      known_obstacles.erase(known_obstacles.begin() + i);
+  }
+  for (int i=0; i<obstacles.size(); ++i)
+    known_obstacles.push_back(obstacles[i] + region.tl());
+
+  std::vector<Victim> old_victims;
+  std::vector<Victim>& known_victims = m_detection.victims;
+  for (int i=known_victims.size()-1; i>=0; --i)
+  {
+    if ((known_victims[i].bbox & region) == known_victims[i].bbox)
+    {
+      old_victims.push_back(known_victims[i]);
+      known_victims.erase(known_victims.begin() + i);
+    }
+  }
+
+  cv::Mat filtered;
+  for (int i=0; i<boxes.size(); ++i)
+  {
+    Victim victim;
+    victim.bbox = boxes[i] + region.tl();
+    victim.center = cv::Point2f(victim.bbox.x + victim.bbox.width/2.f, victim.bbox.y + victim.bbox.height/2.f);
+    victim.digit = -1;
+
+    // A victim that has barely moved keeps its digit
+    for (int j=0; j<old_victims.size(); ++j)
+    {
+      if (iou(old_victims[j].bbox, victim.bbox) > 0.5)
+      {
+        victim.digit = old_victims[j].digit;
+        break;
+      }
+    }
+    if (victim.digit < 0)
+    {
+      if (filtered.empty())
+        filtered = remove_green(patch, green_mask);
+      victim.digit = m_detector.read_digit(filtered, boxes[i], victim.center * (float)m_detection.pixel_scale);
+    }
+    known_victims.push_back(victim);
+  }
+}
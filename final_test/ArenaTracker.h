@@ -0,0 +1,67 @@
+#ifndef ARENA_TRACKER_H
+#define ARENA_TRACKER_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+#include "Arena.h"
+#include "DriftMonitor.h"
+#include "TopViewMap.h"
+
+// Tracking mode of the arena pipeline for a camera stream.
+// The full detection only runs on keyframes. In between, the top view of the
+// new frame is sampled at 1/DIFF_SCALE resolution through a remap table and
+// compared with the one of the last keyframe; segmentation, contours and OCR
+// then run again only inside the changed regions, grown to cover the known
+// objects they touch. A new keyframe is taken when too much of the arena has
+// changed or after keyframe_interval frames. Between keyframes, a
+// DriftMonitor follows the border corners: when the camera moves, the
+// homography and the top view tables are rebuilt from the moved corners,
+// and the objects, in arena coordinates, stay where they are.
+class ArenaTracker
+{
+	private:
+		static const int DIFF_SCALE = 8;
+		static const int DIFF_THRESHOLD = 25;     // gray levels
+		static const int REGION_MARGIN = 16;      // top view pixels around a changed region
+
+		ArenaDetector& m_detector;
+		int m_keyframe_interval;
+		double m_keyframe_change;                 // changed fraction of the arena that forces a keyframe
+
+		ArenaDetection m_detection;
+		int m_frames_since_keyframe;
+		bool m_last_keyframe;
+		std::vector<cv::Rect> m_regions;          // regions processed in the last frame
+		DriftMonitor m_drift;
+		int m_drift_corrections;
+
+		cv::Size m_frame_size;
+		TopViewMap m_top_view;
+		cv::Mat m_small_map1, m_small_map2;       // top view at 1/DIFF_SCALE
+		cv::Mat m_reference;                      // small gray top view of what has been processed
+
+		void keyframe(const cv::Mat& frame);
+		void build_top_view(const cv::Mat& frame);
+		cv::Mat small_top_view(const cv::Mat& frame);
+		std::vector<cv::Rect> changed_regions(const cv::Mat& diff_mask);
+		void update_region(const cv::Mat& frame, const cv::Rect& region);
+
+	public:
+		ArenaTracker(ArenaDetector& detector, int keyframe_interval = 300, double keyframe_change = 0.25);
+
+		// Process one raw camera frame and return the objects in the top view
+		const ArenaDetection& track(const cv::Mat& frame);
+
+		// Force a full detection on the next frame
+		void reset() { m_detection = ArenaDetection(); }
+
+		const ArenaDetection& detection() const { return m_detection; }
+		bool last_keyframe() const { return m_last_keyframe; }
+		const std::vector<cv::Rect>& last_regions() const { return m_regions; }
+		const TopViewMap& top_view() const { return m_top_view; }
+		const DriftMonitor& drift_monitor() const { return m_drift; }
+		int drift_corrections() const { return m_drift_corrections; }
+};
+
+#endif
@@ -0,0 +1,302 @@
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "BitMask.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline int popcount(uint64_t w)
+{
+  return __builtin_popcountll(w);
+}
+
+void BitMask::create (int rows, int cols)
+{
+  m_rows = rows;
+  m_cols = cols;
+  m_words = (cols + 63) / 64;
+  m_bits.assign((size_t)rows * m_words, 0);
+}
+
+// Bits past the last column of every row
+void BitMask::clear_padding ()
+{
+  if (m_cols % 64 == 0) return;
+  uint64_t last = ~(uint64_t)0 >> (64 - m_cols % 64);
+  for (int y=0; y<m_rows; ++y)
+    row(y)[m_words-1] &= last;
+}
+
+void BitMask::set_to (bool value)
+{
+  std::fill(m_bits.begin(), m_bits.end(), value ? ~(uint64_t)0 : 0);
+  if (value) clear_padding();
+}
+
+BitMask& BitMask::operator&= (const BitMask& other)
+{
+  if (other.size() != size())
+    throw std::runtime_error("Bit masks of different sizes");
+  for (size_t i=0; i<m_bits.size(); ++i)
+    m_bits[i] &= other.m_bits[i];
+  return *this;
+}
+
+BitMask& BitMask::operator|= (const BitMask& other)
+{
+  if (other.size() != size())
+    throw std::runtime_error("Bit masks of different sizes");
+  for (size_t i=0; i<m_bits.size(); ++i)
+    m_bits[i] |= other.m_bits[i];
+  return *this;
+}
+
+void BitMask::invert ()
+{
+  for (size_t i=0; i<m_bits.size(); ++i)
+    m_bits[i] = ~m_bits[i];
+  clear_padding();
+}
+
+int BitMask::count () const
+{
+  int n = 0;
+  for (size_t i=0; i<m_bits.size(); ++i)
+    n += popcount(m_bits[i]);
+  return n;
+}
+
+// 8 bits -> 8 bytes of 0 or 255
+struct ByteExpansion
+{
+  uint64_t bytes[256];
+
+  ByteExpansion()
+  {
+    for (int b=0; b<256; ++b)
+    {
+      uchar expanded[8];
+      for (int i=0; i<8; ++i)
+        expanded[i] = (b >> i) & 1 ? 255 : 0;
+      std::memcpy(&bytes[b], expanded, 8);
+    }
+  }
+};
+
+void BitMask::to_mat (cv::Mat& mask) const
+{
+  static const ByteExpansion expansion;
+  mask.create(m_rows, m_cols, CV_8UC1);
+  for (int y=0; y<m_rows; ++y)
+  {
+    const uint64_t* bits = row(y);
+    uchar* out = mask.ptr<uchar>(y);
+    int x = 0;
+    for (; x + 8 <= m_cols; x += 8)
+    {
+      uchar b = (bits[x >> 6] >> (x & 63)) & 0xff;
+      std::memcpy(out + x, &expansion.bytes[b], 8);
+    }
+    for (; x < m_cols; ++x)
+      out[x] = at(y, x) ? 255 : 0;
+  }
+}
+
+// Set the bits of the non zero bytes of a row, 16 at a time with SSE2
+static void pack_row(const uchar* in, int cols, uint64_t* bits)
+{
+  int x = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 16 <= cols; x += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(in + x));
+    uint64_t set = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xffff;
+    bits[x >> 6] |= set << (x & 63);
+  }
+#endif
+  for (; x < cols; ++x)
+    if (in[x]) bits[x >> 6] |= (uint64_t)1 << (x & 63);
+}
+
+void BitMask::from_mat (const cv::Mat& mask)
+{
+  if (mask.type() != CV_8UC1)
+    throw std::runtime_error("Bit masks are made from 8-bit single channel images");
+  create(mask.rows, mask.cols);
+  for (int y=0; y<m_rows; ++y)
+    pack_row(mask.ptr<uchar>(y), m_cols, row(y));
+}
+
+void threshold_hsv(const cv::Mat& hsv_img, const HsvRange* ranges, int n_ranges, BitMask& mask)
+{
+  if (hsv_img.type() != CV_8UC3)
+    throw std::runtime_error("HSV thresholds need an 8-bit 3 channel image");
+  if (n_ranges < 1 || n_ranges > 8)
+    throw std::runtime_error("HSV thresholds take from 1 to 8 ranges");
+
+  // Bit r of lut[c][v] is set when value v of channel c is in range r
+  uchar lut[3][256];
+  std::memset(lut, 0, sizeof(lut));
+  for (int r=0; r<n_ranges; ++r)
+  {
+    for (int c=0; c<3; ++c)
+    {
+      int low = ranges[r].low[c], high = ranges[r].high[c];
+      for (int v=0; v<256; ++v)
+      {
+        bool in = low <= high ? (v >= low && v <= high)
+                              : (c == 0 && (v >= low || v <= high));
+        if (in) lut[c][v] |= 1 << r;
+      }
+    }
+  }
+
+  // The lookups of one row go through a byte buffer, then are packed
+  mask.create(hsv_img.rows, hsv_img.cols);
+  int cols = hsv_img.cols;
+  std::vector<uchar> in_ranges(cols + 1);
+  for (int y=0; y<hsv_img.rows; ++y)
+  {
+    const uchar* p = hsv_img.ptr<uchar>(y);
+    uchar* in = &in_ranges[0];
+    for (int x=0; x<cols; ++x, p+=3)
+      in[x] = lut[0][p[0]] & lut[1][p[1]] & lut[2][p[2]];
+
+    pack_row(in, cols, mask.row(y));
+  }
+}
+
+// Erosion is an AND over the window and treats the outside as set; dilation
+// is an OR and treats the outside as clear
+struct AndOp
+{
+  static const uint64_t outside = ~(uint64_t)0;
+  static uint64_t apply(uint64_t a, uint64_t b) { return a & b; }
+};
+
+struct OrOp
+{
+  static const uint64_t outside = 0;
+  static uint64_t apply(uint64_t a, uint64_t b) { return a | b; }
+};
+
+// Bits x+d of a row for the 64 pixels of word i; the row has enough padding
+// words on both sides
+static inline uint64_t shifted(const uint64_t* p, int i, int d)
+{
+  int q = d >= 0 ? d / 64 : -((63 - d) / 64);
+  int s = d - 64*q;
+  const uint64_t* w = p + i + q;
+  return s == 0 ? w[0] : (w[0] >> s) | (w[1] << (64 - s));
+}
+
+// Extend runs in place: r[i] becomes the combination of the bits x..x+len-1
+// of the original row, len doubling at every step until it reaches k.
+// Words are updated in increasing order, so r[i+1] is still the previous
+// step's value when it is read; the last words stay outside.
+template<class Op>
+static void runs_row(uint64_t* r, int n, int k)
+{
+  for (int len=1; len<k; )
+  {
+    int step = std::min(len, k - len);
+    int last = n - step/64 - 2;
+    for (int i=0; i<=last; ++i)
+      r[i] = Op::apply(r[i], shifted(r, i, step));
+    len += step;
+  }
+}
+
+template<class Op>
+static void morph_bits(const BitMask& src, BitMask& dst, cv::Size ksize)
+{
+  if (ksize.width < 1 || ksize.height < 1)
+    throw std::runtime_error("Empty morphology kernel");
+  if (src.empty())
+  {
+    dst.create(src.rows(), src.cols());
+    return;
+  }
+
+  int rows = src.rows(), cols = src.cols(), words = src.words_per_row();
+  const uint64_t outside = Op::outside;
+  const uint64_t last = cols % 64 ? ~(uint64_t)0 >> (64 - cols % 64) : ~(uint64_t)0;
+
+  // The window of pixel x is [x-ax, x-ax+kw): with ax pixels of outside
+  // padded on the left, it is the run starting at x. Past the right border
+  // the outside value never changes the result.
+  int kw = ksize.width, ax = kw/2;
+  int lpad = (ax + 63) / 64, rpad = (kw + 63) / 64 + 1;
+  int kh = ksize.height, ay = kh/2;
+  std::vector<uint64_t> tmp((size_t)(rows + ay) * words, outside);
+  std::vector<uint64_t> padded(lpad + words + rpad);
+
+  // Horizontal pass, into the rows of tmp below ay rows of outside
+  for (int y=0; y<rows; ++y)
+  {
+    const uint64_t* in = src.row(y);
+    uint64_t* out = &tmp[(size_t)(y + ay) * words];
+    if (kw == 1)
+    {
+      std::copy(in, in + words, out);
+      continue;
+    }
+    std::fill(padded.begin(), padded.end(), outside);
+    uint64_t* p = &padded[lpad];
+    std::copy(in, in + words, p);
+    p[words-1] = (in[words-1] & last) | (outside & ~last);
+    runs_row<Op>(&padded[0], padded.size(), kw);
+    for (int i=0; i<words; ++i)
+      out[i] = shifted(p, i, -ax);
+  }
+
+  // Vertical pass: the same runs, whole rows at a time. Row t of tmp is
+  // image row t-ay, so the run starting at t is the window of image row t.
+  for (int len=1; len<kh; )
+  {
+    int step = std::min(len, kh - len);
+    for (int t=0; t+step<rows+ay; ++t)
+    {
+      uint64_t* r = &tmp[(size_t)t * words];
+      const uint64_t* next = r + (size_t)step * words;
+      for (int i=0; i<words; ++i)
+        r[i] = Op::apply(r[i], next[i]);
+    }
+    len += step;
+  }
+
+  dst.create(rows, cols);
+  for (int y=0; y<rows; ++y)
+  {
+    uint64_t* out = dst.row(y);
+    std::copy(&tmp[(size_t)y * words], &tmp[(size_t)y * words] + words, out);
+    out[words-1] &= last;
+  }
+}
+
+void erode_rect(const BitMask& src, BitMask& dst, cv::Size ksize)
+{
+  morph_bits<AndOp>(src, dst, ksize);
+}
+
+void dilate_rect(const BitMask& src, BitMask& dst, cv::Size ksize)
+{
+  morph_bits<OrOp>(src, dst, ksize);
+}
+
+void open_rect(const BitMask& src, BitMask& dst, cv::Size ksize)
+{
+  morph_bits<AndOp>(src, dst, ksize);
+  morph_bits<OrOp>(dst, dst, ksize);
+}
+
+void close_rect(const BitMask& src, BitMask& dst, cv::Size ksize)
+{
+  morph_bits<OrOp>(src, dst, ksize);
+  morph_bits<AndOp>(dst, dst, ksize);
+}
@@ -0,0 +1,74 @@
+#ifndef BIT_MASK_H
+#define BIT_MASK_H
+
+#include <opencv2/core.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Range of HSV values, bounds included as in cv::inRange. A hue range with
+// low > high wraps around: [low, 179] U [0, high].
+struct HsvRange
+{
+	int low[3];
+	int high[3];
+};
+
+// Binary mask with one bit per pixel. Each row is stored in 64-bit words,
+// pixel x in bit x%64 of word x/64; the bits past the last column are
+// always zero. Logic operations and counts work on whole words, 64 pixels
+// at a time.
+class BitMask
+{
+	private:
+		int m_rows, m_cols, m_words;
+		std::vector<uint64_t> m_bits;
+
+		void clear_padding();
+
+	public:
+		BitMask() : m_rows(0), m_cols(0), m_words(0) { }
+		BitMask(int rows, int cols) { create(rows, cols); }
+
+		// Allocate the mask, all pixels cleared
+		void create(int rows, int cols);
+
+		int rows() const { return m_rows; }
+		int cols() const { return m_cols; }
+		cv::Size size() const { return cv::Size(m_cols, m_rows); }
+		bool empty() const { return m_bits.empty(); }
+		int words_per_row() const { return m_words; }
+
+		uint64_t* row(int y) { return &m_bits[y*m_words]; }
+		const uint64_t* row(int y) const { return &m_bits[y*m_words]; }
+		bool at(int y, int x) const { return (row(y)[x >> 6] >> (x & 63)) & 1; }
+
+		void set_to(bool value);
+
+		// Same size masks only
+		BitMask& operator&=(const BitMask& other);
+		BitMask& operator|=(const BitMask& other);
+		void invert();
+
+		// Number of pixels set
+		int count() const;
+
+		// 8-bit mask, 255 where set (as produced by cv::inRange)
+		void to_mat(cv::Mat& mask) const;
+		// Set where the 8-bit mask is non zero
+		void from_mat(const cv::Mat& mask);
+};
+
+// Threshold an HSV image straight into a bit mask: a pixel is set when it
+// falls in any of the ranges, so the two halves of a hue range crossing 0
+// are merged in the same pass (up to 8 ranges).
+void threshold_hsv(const cv::Mat& hsv_img, const HsvRange* ranges, int n_ranges, BitMask& mask);
+
+// Erosion and dilation with rectangular kernels, by shifting and combining
+// whole words; same anchor and border handling as cv::erode/cv::dilate with
+// default arguments. src and dst may be the same.
+void erode_rect(const BitMask& src, BitMask& dst, cv::Size ksize);
+void dilate_rect(const BitMask& src, BitMask& dst, cv::Size ksize);
+void open_rect(const BitMask& src, BitMask& dst, cv::Size ksize);
+void close_rect(const BitMask& src, BitMask& dst, cv::Size ksize);
+
+#endif
@@ -0,0 +1,248 @@
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "Blobs.h"
+
+// Bands shorter than this are not worth a thread
+static const int MIN_BAND_ROWS = 64;
+
+// Horizontal run of pixels of one class, [x0, x1)
+struct Run
+{
+  int x0, x1;
+  int label;
+  uchar cls;
+};
+
+// Raw moments and extent of the pixels of a label
+struct Accumulator
+{
+  int64_t m00, m10, m01, m20, m11, m02;
+  int xmin, xmax, ymin, ymax;
+  uchar cls;
+
+  void add_run(int x0, int x1, int y)
+  {
+    int64_t n = x1 - x0;
+    int64_t sx = n * (x0 + x1 - 1) / 2;
+    int64_t sxx = sum_squares(x1 - 1) - sum_squares(x0 - 1);
+    m00 += n;
+    m10 += sx;
+    m01 += n * y;
+    m20 += sxx;
+    m11 += sx * y;
+    m02 += n * y * y;
+    xmin = std::min(xmin, x0);
+    xmax = std::max(xmax, x1 - 1);
+    ymin = std::min(ymin, y);
+    ymax = std::max(ymax, y);
+  }
+
+  void add(const Accumulator& other)
+  {
+    m00 += other.m00; m10 += other.m10; m01 += other.m01;
+    m20 += other.m20; m11 += other.m11; m02 += other.m02;
+    xmin = std::min(xmin, other.xmin);
+    xmax = std::max(xmax, other.xmax);
+    ymin = std::min(ymin, other.ymin);
+    ymax = std::max(ymax, other.ymax);
+  }
+
+  // 0^2 + 1^2 + ... + k^2
+  static int64_t sum_squares(int64_t k) { return k < 0 ? 0 : k * (k + 1) * (2*k + 1) / 6; }
+};
+
+static Accumulator new_accumulator(uchar cls)
+{
+  Accumulator acc = { 0, 0, 0, 0, 0, 0, INT_MAX, -1, INT_MAX, -1, cls };
+  return acc;
+}
+
+// Union-find with path halving; the root is the smallest label, so that the
+// roots come in raster order
+static int find_root(std::vector<int>& parent, int label)
+{
+  while (parent[label] != label)
+  {
+    parent[label] = parent[parent[label]];
+    label = parent[label];
+  }
+  return label;
+}
+
+static void unite(std::vector<int>& parent, int a, int b)
+{
+  a = find_root(parent, a);
+  b = find_root(parent, b);
+  if (a < b) parent[b] = a;
+  else if (b < a) parent[a] = b;
+}
+
+// Provisional labels of one band of rows
+struct Band
+{
+  std::vector<int> parent;
+  std::vector<Accumulator> stats;
+  std::vector<Run> first_row, last_row;
+};
+
+static void row_runs(const uchar* row, int cols, std::vector<Run>& runs)
+{
+  runs.clear();
+  for (int x=0; x<cols; )
+  {
+    uchar cls = row[x];
+    int x0 = x;
+    while (x < cols && row[x] == cls) ++x;
+    if (cls == 0) continue;
+    Run run = { x0, x, -1, cls };
+    runs.push_back(run);
+  }
+}
+
+// Link the runs of a row to the touching runs (8-connectivity) of the same
+// class in the row above, creating labels for the ones that touch none
+static void link_runs(std::vector<Run>& runs, const std::vector<Run>& above, Band& band)
+{
+  int j = 0;
+  for (int i=0; i<runs.size(); ++i)
+  {
+    Run& run = runs[i];
+    // Runs above ending before run.x0-1 can touch no later run either
+    while (j < above.size() && above[j].x1 < run.x0) ++j;
+    for (int k=j; k<above.size() && above[k].x0 <= run.x1; ++k)
+    {
+      if (above[k].cls != run.cls) continue;
+      if (run.label < 0) run.label = above[k].label;
+      else unite(band.parent, run.label, above[k].label);
+    }
+    if (run.label < 0)
+    {
+      run.label = band.parent.size();
+      band.parent.push_back(run.label);
+      band.stats.push_back(new_accumulator(run.cls));
+    }
+  }
+}
+
+static void label_band(const cv::Mat& classes, int begin, int end, Band& band)
+{
+  std::vector<Run> above, runs;
+  for (int y=begin; y<end; ++y)
+  {
+    row_runs(classes.ptr<uchar>(y), classes.cols, runs);
+    link_runs(runs, above, band);
+    for (int i=0; i<runs.size(); ++i)
+      band.stats[runs[i].label].add_run(runs[i].x0, runs[i].x1, y);
+    if (y == begin) band.first_row = runs;
+    std::swap(above, runs);
+  }
+  band.last_row = above;
+}
+
+class LabelBands : public cv::ParallelLoopBody
+{
+  private:
+    const cv::Mat& m_classes;
+    std::vector<Band>& m_bands;
+    int m_band_rows;
+
+  public:
+    LabelBands(const cv::Mat& classes, std::vector<Band>& bands, int band_rows)
+      : m_classes(classes), m_bands(bands), m_band_rows(band_rows) { }
+
+    void operator()(const cv::Range& range) const
+    {
+      for (int b=range.start; b<range.end; ++b)
+      {
+        int begin = b * m_band_rows;
+        int end = std::min(begin + m_band_rows, m_classes.rows);
+        label_band(m_classes, begin, end, m_bands[b]);
+      }
+    }
+};
+
+void class_map(const std::vector<cv::Mat>& masks, cv::Mat& classes)
+{
+  if (masks.empty())
+    throw std::runtime_error("No masks for the class map");
+  if (masks.size() > 255)
+    throw std::runtime_error("Too many masks for an 8-bit class map");
+  classes.create(masks[0].size(), CV_8UC1);
+  classes.setTo(cv::Scalar(0));
+  for (int i=0; i<masks.size(); ++i)
+    classes.setTo(cv::Scalar(i + 1), masks[i]);
+}
+
+std::vector<Blob> label_blobs(const cv::Mat& classes, int min_area)
+{
+  if (classes.type() != CV_8UC1)
+    throw std::runtime_error("Blobs are labelled on 8-bit single channel class maps");
+
+  int n_bands = std::max(1, std::min(cv::getNumThreads(), classes.rows / MIN_BAND_ROWS));
+  int band_rows = (classes.rows + n_bands - 1) / n_bands;
+  std::vector<Band> bands(n_bands);
+  cv::parallel_for_(cv::Range(0, n_bands), LabelBands(classes, bands, band_rows));
+
+  // Global labels: the ones of band b are offset by the labels of the bands
+  // above it, which keeps the raster order
+  std::vector<int> parent;
+  std::vector<Accumulator> stats;
+  for (int b=0; b<n_bands; ++b)
+  {
+    int offset = parent.size();
+    for (int i=0; i<bands[b].parent.size(); ++i)
+      parent.push_back(bands[b].parent[i] + offset);
+    stats.insert(stats.end(), bands[b].stats.begin(), bands[b].stats.end());
+    for (int i=0; i<bands[b].first_row.size(); ++i)
+      bands[b].first_row[i].label += offset;
+    for (int i=0; i<bands[b].last_row.size(); ++i)
+      bands[b].last_row[i].label += offset;
+  }
+
+  // Join the blobs cut by the border between two bands
+  for (int b=1; b<n_bands; ++b)
+  {
+    const std::vector<Run>& above = bands[b-1].last_row;
+    const std::vector<Run>& below = bands[b].first_row;
+    int j = 0;
+    for (int i=0; i<below.size(); ++i)
+    {
+      while (j < above.size() && above[j].x1 < below[i].x0) ++j;
+      for (int k=j; k<above.size() && above[k].x0 <= below[i].x1; ++k)
+      {
+        if (above[k].cls == below[i].cls)
+          unite(parent, below[i].label, above[k].label);
+      }
+    }
+  }
+
+  // Every label adds its moments to its root
+  for (int l=0; l<parent.size(); ++l)
+  {
+    int root = find_root(parent, l);
+    if (root != l) stats[root].add(stats[l]);
+  }
+
+  std::vector<Blob> blobs;
+  for (int l=0; l<parent.size(); ++l)
+  {
+    const Accumulator& acc = stats[l];
+    if (parent[l] != l || acc.m00 < min_area || acc.m00 == 0) continue;
+
+    Blob blob;
+    blob.cls = acc.cls;
+    blob.area = acc.m00;
+    blob.bbox = cv::Rect(acc.xmin, acc.ymin, acc.xmax - acc.xmin + 1, acc.ymax - acc.ymin + 1);
+    double cx = (double)acc.m10 / acc.m00, cy = (double)acc.m01 / acc.m00;
+    blob.centroid = cv::Point2f(cx, cy);
+    blob.mu20 = acc.m20 - cx * acc.m10;
+    blob.mu11 = acc.m11 - cx * acc.m01;
+    blob.mu02 = acc.m02 - cy * acc.m01;
+    blobs.push_back(blob);
+  }
+  return blobs;
+}
@@ -0,0 +1,28 @@
+#ifndef BLOBS_H
+#define BLOBS_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+// Statistics of one 8-connected blob of a class map
+struct Blob
+{
+	int cls;                  // class of its pixels, from 1
+	int area;                 // pixels
+	cv::Rect bbox;
+	cv::Point2f centroid;
+	double mu20, mu11, mu02;  // central second moments, summed over the pixels
+};
+
+// Class map of a set of binary masks: index+1 of the last mask set at each
+// pixel, 0 where none is
+void class_map(const std::vector<cv::Mat>& masks, cv::Mat& classes);
+
+// Blobs of every class of a CV_8UC1 class map (0 is the background) with at
+// least min_area pixels, in raster order of their first pixel. The map is
+// scanned once: runs of equal class are linked to the touching runs of the
+// row above with a union-find, and their moments accumulated on the fly.
+// Bands of rows are labelled in parallel, then joined along their borders.
+std::vector<Blob> label_blobs(const cv::Mat& classes, int min_area = 0);
+
+#endif
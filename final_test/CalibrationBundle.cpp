@@ -0,0 +1,261 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CalibrationBundle.h"
+
+static const uint32_t BUNDLE_MAGIC = 0x424c4143;  // "CALB"
+// Bump when the layout of the header or of the tables changes
+static const uint32_t BUNDLE_VERSION = 1;
+static const int MAX_DIST_COEFFS = 14;
+static const size_t TABLE_ALIGNMENT = 64;
+
+struct BundleHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_bytes;
+  uint32_t has_persp_transf;
+  int32_t width, height;
+  int32_t n_dist_coeffs;
+  int32_t reserved;
+  double camera_matrix[9];
+  double dist_coeffs[MAX_DIST_COEFFS];
+  double new_camera_matrix[9];
+  double persp_transf[9];
+  double pixel_scale;
+  uint64_t map1_offset, map2_offset;
+  uint64_t file_bytes;
+};
+
+static size_t aligned(size_t offset)
+{
+  return (offset + TABLE_ALIGNMENT - 1) / TABLE_ALIGNMENT * TABLE_ALIGNMENT;
+}
+
+static void copy_values(const cv::Mat& m, double* values, int n)
+{
+  cv::Mat m64;
+  m.convertTo(m64, CV_64F);
+  if (m64.total() != n)
+    throw std::runtime_error("Unexpected matrix size in the calibration");
+  m64 = m64.reshape(1, 1).clone();
+  std::memcpy(values, m64.ptr<double>(), n * sizeof(double));
+}
+
+void CalibrationBundle::write (const std::string& filename, const cv::Mat& camera_matrix,
+                               const cv::Mat& dist_coeffs, cv::Size frame_size,
+                               const cv::Mat& persp_transf, double pixel_scale)
+{
+  if (dist_coeffs.total() > MAX_DIST_COEFFS)
+    throw std::runtime_error("Too many distortion coefficients for the calibration bundle");
+
+  // Same tables as cv::undistort builds on every call
+  cv::Mat new_camera_matrix = cv::getOptimalNewCameraMatrix(camera_matrix, dist_coeffs, frame_size, 0);
+  cv::Mat map1, map2;
+  cv::initUndistortRectifyMap(camera_matrix, dist_coeffs, cv::Mat(), new_camera_matrix,
+                              frame_size, CV_16SC2, map1, map2);
+
+  BundleHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = BUNDLE_MAGIC;
+  header.version = BUNDLE_VERSION;
+  header.header_bytes = sizeof(BundleHeader);
+  header.width = frame_size.width;
+  header.height = frame_size.height;
+  header.n_dist_coeffs = dist_coeffs.total();
+  copy_values(camera_matrix, header.camera_matrix, 9);
+  copy_values(dist_coeffs, header.dist_coeffs, header.n_dist_coeffs);
+  copy_values(new_camera_matrix, header.new_camera_matrix, 9);
+  if (!persp_transf.empty())
+  {
+    header.has_persp_transf = 1;
+    copy_values(persp_transf, header.persp_transf, 9);
+    header.pixel_scale = pixel_scale;
+  }
+
+  size_t map1_bytes = map1.total() * map1.elemSize();
+  size_t map2_bytes = map2.total() * map2.elemSize();
+  header.map1_offset = aligned(sizeof(BundleHeader));
+  header.map2_offset = aligned(header.map1_offset + map1_bytes);
+  header.file_bytes = header.map2_offset + map2_bytes;
+
+  // Written aside and renamed over the old file: a process that has it
+  // mapped (possibly the caller, whose matrices may come from it) keeps
+  // the old pages
+  std::string tmp_name = filename + ".tmp";
+  std::ofstream file(tmp_name.c_str(), std::ios::binary | std::ios::trunc);
+  std::vector<char> padding(TABLE_ALIGNMENT, 0);
+  file.write((const char*)&header, sizeof(header));
+  file.write(&padding[0], header.map1_offset - sizeof(header));
+  file.write((const char*)map1.ptr(), map1_bytes);
+  file.write(&padding[0], header.map2_offset - header.map1_offset - map1_bytes);
+  file.write((const char*)map2.ptr(), map2_bytes);
+  file.close();
+  if (!file || std::rename(tmp_name.c_str(), filename.c_str()) != 0)
+  {
+    std::remove(tmp_name.c_str());
+    throw std::runtime_error("Could not write file " + filename);
+  }
+}
+
+void CalibrationBundle::open (const std::string& filename)
+{
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Could not open file " + filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(BundleHeader))
+  {
+    ::close(fd);
+    throw std::runtime_error("Truncated calibration bundle " + filename);
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);  // the mapping keeps the file
+  if (data == MAP_FAILED)
+    throw std::runtime_error("Could not map file " + filename);
+  m_data = data;
+  m_size = st.st_size;
+
+  const BundleHeader& header = *(const BundleHeader*)m_data;
+  if (header.magic != BUNDLE_MAGIC || header.version != BUNDLE_VERSION
+      || header.header_bytes != sizeof(BundleHeader))
+  {
+    close();
+    throw std::runtime_error("Not a calibration bundle of version " + std::to_string(BUNDLE_VERSION) + ": " + filename);
+  }
+  size_t map1_bytes = (size_t)header.width * header.height * 4;
+  size_t map2_bytes = (size_t)header.width * header.height * 2;
+  if (header.file_bytes != m_size || header.width <= 0 || header.height <= 0
+      || header.n_dist_coeffs < 0 || header.n_dist_coeffs > MAX_DIST_COEFFS
+      || header.map1_offset + map1_bytes > m_size || header.map2_offset + map2_bytes > m_size)
+  {
+    close();
+    throw std::runtime_error("Truncated calibration bundle " + filename);
+  }
+
+  // Headers over the mapping: writing through them would fault
+  uchar* base = (uchar*)m_data;
+  m_frame_size = cv::Size(header.width, header.height);
+  m_camera_matrix = cv::Mat(3, 3, CV_64F, (void*)header.camera_matrix);
+  m_dist_coeffs = cv::Mat(header.n_dist_coeffs, 1, CV_64F, (void*)header.dist_coeffs);
+  m_new_camera_matrix = cv::Mat(3, 3, CV_64F, (void*)header.new_camera_matrix);
+  if (header.has_persp_transf)
+  {
+    m_persp_transf = cv::Mat(3, 3, CV_64F, (void*)header.persp_transf);
+    m_pixel_scale = header.pixel_scale;
+  }
+  m_map1 = cv::Mat(m_frame_size, CV_16SC2, base + header.map1_offset);
+  m_map2 = cv::Mat(m_frame_size, CV_16UC1, base + header.map2_offset);
+}
+
+void CalibrationBundle::close ()
+{
+  m_camera_matrix.release();
+  m_dist_coeffs.release();
+  m_new_camera_matrix.release();
+  m_persp_transf.release();
+  m_map1.release();
+  m_map2.release();
+  m_pixel_scale = 0;
+  if (m_data)
+    munmap(m_data, m_size);
+  m_data = NULL;
+  m_size = 0;
+}
+
+static bool modified_time(const std::string& filename, time_t& mtime)
+{
+  struct stat st;
+  if (filename.empty() || stat(filename.c_str(), &st) != 0)
+    return false;
+  mtime = st.st_mtime;
+  return true;
+}
+
+// Opens the bundle unless it is missing or older than the text file it
+// replaces; false when the text file is to be read instead
+static bool open_current(const std::string& bundle_file, const std::string& text_file,
+                         CalibrationBundle& bundle)
+{
+  time_t bundle_time, text_time;
+  bool has_bundle = modified_time(bundle_file, bundle_time);
+  bool has_text = modified_time(text_file, text_time);
+  // A bundle older than the text file was written before it was changed
+  if (!has_bundle || (has_text && bundle_time < text_time))
+    return false;
+  try
+  {
+    bundle.open(bundle_file);
+    return true;
+  }
+  catch (const std::runtime_error&)
+  {
+    // of another version or truncated: the text file is still there
+    if (!has_text)
+      throw;
+  }
+  return false;
+}
+
+void load_calibration (const std::string& bundle_file, const std::string& xml_file,
+                       CalibrationBundle& bundle, cv::Mat& camera_matrix, cv::Mat& dist_coeffs)
+{
+  if (open_current(bundle_file, xml_file, bundle))
+  {
+    camera_matrix = bundle.camera_matrix();
+    dist_coeffs = bundle.dist_coeffs();
+    return;
+  }
+
+  cv::FileStorage fs( xml_file, cv::FileStorage::READ );
+  if (!fs.isOpened())
+  {
+    throw std::runtime_error("Could not open file " + xml_file);
+  }
+  fs["camera_matrix"] >> camera_matrix;
+  fs["distortion_coefficients"] >> dist_coeffs;
+  fs.release();
+}
+
+void load_arena_calibration (const std::string& bundle_file, const std::string& yml_file,
+                             CalibrationBundle& bundle, cv::Mat& camera_matrix, cv::Mat& dist_coeffs,
+                             cv::Mat& persp_transf, double& pixel_scale)
+{
+  if (open_current(bundle_file, yml_file, bundle))
+  {
+    if (!bundle.persp_transf().empty())
+    {
+      camera_matrix = bundle.camera_matrix();
+      dist_coeffs = bundle.dist_coeffs();
+      persp_transf = bundle.persp_transf();
+      pixel_scale = bundle.pixel_scale();
+      return;
+    }
+    bundle.close();
+  }
+
+  cv::FileStorage fs( yml_file, cv::FileStorage::READ );
+  if (!fs.isOpened())
+  {
+    throw std::runtime_error("Could not open file " + yml_file);
+  }
+  fs["camera_matrix"] >> camera_matrix;
+  fs["dist_coeffs"] >> dist_coeffs;
+  fs["pixel_scale"] >> pixel_scale;
+  fs["persp_transf"] >> persp_transf;
+  fs.release();
+}
@@ -0,0 +1,69 @@
+#ifndef CALIBRATION_BUNDLE_H
+#define CALIBRATION_BUNDLE_H
+
+#include <opencv2/core.hpp>
+#include <string>
+
+// Calibration of the camera in a single binary file, mapped read-only in
+// memory: intrinsics, distortion, the camera matrix of the undistorted
+// frames, the arena homography and pixel scale, and the fixed-point
+// undistortion tables of cv::remap for one frame size. Nothing is parsed
+// or computed at load time, the matrices point into the mapping, and the
+// processes that open the same file share its pages.
+// The file starts with a versioned header of fixed-size fields, in the
+// byte order of the machine that wrote it; the tables are 64-byte aligned.
+class CalibrationBundle
+{
+	private:
+		void* m_data;
+		size_t m_size;
+
+		cv::Size m_frame_size;
+		cv::Mat m_camera_matrix, m_dist_coeffs, m_new_camera_matrix;
+		cv::Mat m_persp_transf;
+		double m_pixel_scale;
+		cv::Mat m_map1, m_map2;    // CV_16SC2 and CV_16UC1
+
+		CalibrationBundle(const CalibrationBundle&);
+		CalibrationBundle& operator=(const CalibrationBundle&);
+
+	public:
+		CalibrationBundle() : m_data(NULL), m_size(0), m_pixel_scale(0) { }
+		~CalibrationBundle() { close(); }
+
+		// Throws when the file is missing, of another version or truncated
+		void open(const std::string& filename);
+		void close();
+		bool is_open() const { return m_data != NULL; }
+
+		// persp_transf may be empty (intrinsics only), in which case
+		// pixel_scale is ignored
+		static void write(const std::string& filename, const cv::Mat& camera_matrix,
+		                  const cv::Mat& dist_coeffs, cv::Size frame_size,
+		                  const cv::Mat& persp_transf, double pixel_scale);
+
+		// Read-only views of the mapping, valid until close
+		cv::Size frame_size() const { return m_frame_size; }
+		const cv::Mat& camera_matrix() const { return m_camera_matrix; }
+		const cv::Mat& dist_coeffs() const { return m_dist_coeffs; }
+		const cv::Mat& new_camera_matrix() const { return m_new_camera_matrix; }
+		const cv::Mat& persp_transf() const { return m_persp_transf; }
+		double pixel_scale() const { return m_pixel_scale; }
+		const cv::Mat& map1() const { return m_map1; }
+		const cv::Mat& map2() const { return m_map2; }
+};
+
+// Intrinsics of the camera, from the bundle when there is one that is not
+// older than the XML of the calibration tool (it is then left open, for
+// its undistortion tables), from the XML otherwise. bundle_file may be
+// empty. Throws when neither file can be read.
+void load_calibration(const std::string& bundle_file, const std::string& xml_file,
+                      CalibrationBundle& bundle, cv::Mat& camera_matrix, cv::Mat& dist_coeffs);
+
+// Same with the arena homography and pixel scale, from a bundle that holds
+// them, or from the fullCalibration.yml written with it
+void load_arena_calibration(const std::string& bundle_file, const std::string& yml_file,
+                            CalibrationBundle& bundle, cv::Mat& camera_matrix, cv::Mat& dist_coeffs,
+                            cv::Mat& persp_transf, double& pixel_scale);
+
+#endif
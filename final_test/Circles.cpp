@@ -0,0 +1,56 @@
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+
+#include "Circles.h"
+
+bool fit_circle(const std::vector<cv::Point>& contour, Circle& circle)
+{
+  cv::Moments m = cv::moments(contour);
+  if (m.m00 <= 0) return false;
+
+  circle.center = cv::Point2f(m.m10 / m.m00, m.m01 / m.m00);
+  circle.radius = std::sqrt(m.m00 / CV_PI);
+
+  // Eigenvalues of the covariance of the region: equal for a disc
+  double a = m.mu20 / m.m00, b = m.mu11 / m.m00, c = m.mu02 / m.m00;
+  double d = std::sqrt((a - c)*(a - c) + 4*b*b);
+  double isotropy = a + c > 0 ? (a + c - d) / (a + c + d) : 0;
+
+  // Distances from the centre to the outline: constant for a circle
+  double sum = 0, sum_sq = 0;
+  for (int i=0; i<contour.size(); ++i)
+  {
+    double dx = contour[i].x - circle.center.x, dy = contour[i].y - circle.center.y;
+    double r2 = dx*dx + dy*dy;
+    sum += std::sqrt(r2);
+    sum_sq += r2;
+  }
+  double mean = sum / contour.size();
+  double stddev = std::sqrt(std::max(sum_sq / contour.size() - mean*mean, 0.0));
+  double roundness = mean > 0 ? std::max(1 - stddev / mean, 0.0) : 0;
+
+  circle.confidence = isotropy * roundness;
+  return true;
+}
+
+std::vector<Circle> find_circles(const cv::Mat& mask, float min_radius, float min_confidence)
+{
+  // CHAIN_APPROX_NONE: every point of the outline weighs the same in the
+  // distance spread
+  std::vector<std::vector<cv::Point>> contours;
+  cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+
+  std::vector<Circle> circles;
+  double min_area = CV_PI * min_radius * min_radius;
+  for (int i=0; i<contours.size(); ++i)
+  {
+    // contourArea is cheaper than the moments: reject the small blobs first
+    if (cv::contourArea(contours[i]) < min_area) continue;
+    Circle circle;
+    if (fit_circle(contours[i], circle) && circle.confidence >= min_confidence)
+      circles.push_back(circle);
+  }
+  return circles;
+}
@@ -0,0 +1,27 @@
+#ifndef CIRCLES_H
+#define CIRCLES_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+// Circle fitted to a blob of a binary mask. confidence is 1 for a perfect
+// disc and drops with elongation (ratio of the axes of inertia) and with the
+// spread of the distances from the centre to the outline.
+struct Circle
+{
+	cv::Point2f center;
+	float radius;
+	float confidence;
+};
+
+// Fit a circle to the region enclosed by an external contour, from its
+// moments: centroid as the centre, radius of the disc of the same area.
+// Holes (the digit of a victim) do not change the result. Returns false for
+// degenerate contours.
+bool fit_circle(const std::vector<cv::Point>& contour, Circle& circle);
+
+// Circles among the blobs of a binary mask, in one pass of findContours
+// instead of GaussianBlur + HoughCircles on the whole mask
+std::vector<Circle> find_circles(const cv::Mat& mask, float min_radius = 10, float min_confidence = 0.8f);
+
+#endif
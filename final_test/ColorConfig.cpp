@@ -0,0 +1,120 @@
+#include <opencv2/core.hpp>
+#include <stdexcept>
+
+#include "ColorConfig.h"
+
+static HsvRange hsv_range(int low_h, int low_s, int low_v, int high_h, int high_s, int high_v)
+{
+  HsvRange range = { { low_h, low_s, low_v }, { high_h, high_s, high_v } };
+  return range;
+}
+
+ColorConfig ColorConfig::defaults ()
+{
+  ColorConfig config;
+  // Black regions (filter on saturation and value)
+  config.set("border", std::vector<HsvRange>(1, hsv_range(0, 0, 0, 180, 255, 100)));
+  config.set("gate", std::vector<HsvRange>(1, hsv_range(100, 50, 55, 115, 255, 255)));
+
+  // Red regions: h values around 0 (positive and negative angle), clear
+  // of the wooden floor (h 20-26, s 60-95)
+  std::vector<HsvRange> red;
+  red.push_back(hsv_range(0, 70, 100, 12, 255, 255));
+  red.push_back(hsv_range(160, 70, 100, 179, 255, 255));
+  config.set("obstacle", red);
+
+  config.set("victim", std::vector<HsvRange>(1, hsv_range(40, 60, 80, 88, 249, 255)));
+
+  // Blue triangular marker of the robot; wider than the gate, which only
+  // the shape test tells apart
+  config.set("robot", std::vector<HsvRange>(1, hsv_range(90, 50, 55, 115, 255, 255)));
+
+  std::vector<HsvRange> map_red;
+  map_red.push_back(hsv_range(0, 85, 175, 5, 140, 255));
+  map_red.push_back(hsv_range(5, 85, 175, 180, 140, 255));
+  config.set("map_obstacle", map_red);
+  return config;
+}
+
+void ColorConfig::set (const std::string& name, const std::vector<HsvRange>& ranges)
+{
+  if (ranges.empty() || ranges.size() > 8)
+    throw std::runtime_error("Colour class " + name + " needs from 1 to 8 ranges");
+  for (int i=0; i<ranges.size(); ++i)
+  {
+    for (int c=0; c<3; ++c)
+    {
+      int max_value = c == 0 ? 180 : 255;
+      if (ranges[i].low[c] < 0 || ranges[i].low[c] > max_value
+          || ranges[i].high[c] < 0 || ranges[i].high[c] > max_value)
+        throw std::runtime_error("HSV range out of bounds in colour class " + name);
+    }
+  }
+  m_classes[name] = ranges;
+}
+
+bool ColorConfig::has (const std::string& name) const
+{
+  return m_classes.count(name) != 0;
+}
+
+const std::vector<HsvRange>& ColorConfig::ranges (const std::string& name) const
+{
+  std::map<std::string, std::vector<HsvRange> >::const_iterator it = m_classes.find(name);
+  if (it == m_classes.end())
+    throw std::runtime_error("No colour class " + name);
+  return it->second;
+}
+
+std::vector<std::string> ColorConfig::names () const
+{
+  std::vector<std::string> names;
+  std::map<std::string, std::vector<HsvRange> >::const_iterator it;
+  for (it = m_classes.begin(); it != m_classes.end(); ++it)
+    names.push_back(it->first);
+  return names;
+}
+
+void ColorConfig::load (const std::string& filename)
+{
+  cv::FileStorage fs(filename, cv::FileStorage::READ);
+  if (!fs.isOpened())
+    throw std::runtime_error("Could not open file " + filename);
+
+  cv::FileNode root = fs.root();
+  for (cv::FileNodeIterator it = root.begin(); it != root.end(); ++it)
+  {
+    cv::FileNode node = *it;
+    std::vector<HsvRange> ranges;
+    for (cv::FileNodeIterator r = node.begin(); r != node.end(); ++r)
+    {
+      cv::FileNode values = *r;
+      if (!values.isSeq() || values.size() != 6)
+        throw std::runtime_error("Colour class " + node.name() + " in " + filename
+                                 + ": a range is a sequence of 6 values");
+      ranges.push_back(hsv_range((int)values[0], (int)values[1], (int)values[2],
+                                 (int)values[3], (int)values[4], (int)values[5]));
+    }
+    set(node.name(), ranges);
+  }
+}
+
+void ColorConfig::save (const std::string& filename) const
+{
+  cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+  if (!fs.isOpened())
+    throw std::runtime_error("Could not write file " + filename);
+
+  std::map<std::string, std::vector<HsvRange> >::const_iterator it;
+  for (it = m_classes.begin(); it != m_classes.end(); ++it)
+  {
+    fs << it->first << "[";
+    for (int i=0; i<it->second.size(); ++i)
+    {
+      const HsvRange& range = it->second[i];
+      fs << "[:" << range.low[0] << range.low[1] << range.low[2]
+         << range.high[0] << range.high[1] << range.high[2] << "]";
+    }
+    fs << "]";
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef COLOR_CONFIG_H
+#define COLOR_CONFIG_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "BitMask.h"
+
+// Named colour classes of the pipeline, each the union of 1 to 8 HSV
+// ranges. The file is written by the hsv_tuner tool with cv::FileStorage,
+// one [ low_h, low_s, low_v, high_h, high_s, high_v ] sequence per range:
+//   obstacle:
+//      - [ 0, 70, 100, 12, 255, 255 ]
+//      - [ 160, 70, 100, 179, 255, 255 ]
+class ColorConfig
+{
+	private:
+		std::map<std::string, std::vector<HsvRange> > m_classes;
+
+	public:
+		// The ranges the pipeline was tuned with: "border", "gate",
+		// "obstacle" and "victim" of the arena, "robot" of RobotTracker,
+		// "map_obstacle" of Map
+		static ColorConfig defaults();
+
+		void set(const std::string& name, const std::vector<HsvRange>& ranges);
+		bool has(const std::string& name) const;
+		const std::vector<HsvRange>& ranges(const std::string& name) const;
+		std::vector<std::string> names() const;
+
+		// Classes of the file replace the ones with the same name, the
+		// others are kept
+		void load(const std::string& filename);
+		void save(const std::string& filename) const;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "DigitCache.h"
+
+static const float MATCH_DISTANCE = 30;     // mm between the centres of the same victim
+static const int MAX_HASH_DISTANCE = 12;    // differing bits of the same image; two victims differ by more
+
+static int hamming(uint64_t a, uint64_t b)
+{
+  uint64_t x = a ^ b;
+  int n = 0;
+  for (; x != 0; x &= x - 1)
+    ++n;
+  return n;
+}
+
+uint64_t DigitCache::image_hash (const cv::Mat& roi)
+{
+  cv::Mat gray, thumb;
+  if (roi.channels() == 3)
+    cv::cvtColor(roi, gray, cv::COLOR_BGR2GRAY);
+  else
+    gray = roi;
+  cv::resize(gray, thumb, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+
+  uint64_t hash = 0;
+  for (int y=0; y<8; ++y)
+  {
+    const uchar* row = thumb.ptr<uchar>(y);
+    for (int x=0; x<8; ++x)
+      hash = (hash << 1) | (row[x] < row[x + 1]);
+  }
+  return hash;
+}
+
+// Index of the entry closest to position, -1 if none is near enough
+int DigitCache::nearest (cv::Point2f position) const
+{
+  int best = -1;
+  float best_d2 = MATCH_DISTANCE * MATCH_DISTANCE;
+  for (int i=0; i<m_entries.size(); ++i)
+  {
+    cv::Point2f d = m_entries[i].position - position;
+    if (d.dot(d) < best_d2)
+    {
+      best = i;
+      best_d2 = d.dot(d);
+    }
+  }
+  return best;
+}
+
+bool DigitCache::lookup (cv::Point2f position, uint64_t hash, int& digit)
+{
+  int i = nearest(position);
+  if (i < 0 || hamming(m_entries[i].hash, hash) > MAX_HASH_DISTANCE)
+  {
+    ++m_misses;
+    return false;
+  }
+  ++m_hits;
+  digit = m_entries[i].digit;
+  return true;
+}
+
+void DigitCache::store (cv::Point2f position, uint64_t hash, int digit)
+{
+  Entry entry = { position, hash, digit };
+  int i = nearest(position);
+  if (i < 0)
+    m_entries.push_back(entry);
+  else
+    m_entries[i] = entry;
+}
@@ -0,0 +1,45 @@
+#ifndef DIGIT_CACHE_H
+#define DIGIT_CACHE_H
+
+#include <opencv2/core.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Digits already read, so that the OCR only runs for a new victim or when
+// its image has changed: the digits of the victims do not change during a
+// mission. An entry is found by the position of the victim in the arena,
+// then checked against a difference hash of the image the OCR would read.
+class DigitCache
+{
+	private:
+		struct Entry
+		{
+			cv::Point2f position;     // mm
+			uint64_t hash;
+			int digit;
+		};
+		std::vector<Entry> m_entries;
+		int m_hits, m_misses;
+
+		int nearest(cv::Point2f position) const;
+
+	public:
+		DigitCache() : m_hits(0), m_misses(0) { }
+
+		// 64 bits from the sign of the horizontal gradient of the 9x8 gray
+		// thumbnail of the image
+		static uint64_t image_hash(const cv::Mat& roi);
+
+		// Digit of the victim at position, or false when there is none or its
+		// hash is too far from hash
+		bool lookup(cv::Point2f position, uint64_t hash, int& digit);
+
+		// Replaces the entry at position, if any
+		void store(cv::Point2f position, uint64_t hash, int digit);
+
+		void clear() { m_entries.clear(); }
+		int hits() const { return m_hits; }
+		int misses() const { return m_misses; }
+};
+
+#endif
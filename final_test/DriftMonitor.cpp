@@ -0,0 +1,108 @@
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "DriftMonitor.h"
+#include "Trace.h"
+
+static const float DRIFT_THRESHOLD = 2;    // pixels of corner displacement
+static const int DRIFT_FRAMES = 3;         // in a row, so a shake does not trigger it
+static const int MIN_MOVED_CORNERS = 3;
+static const float MAX_BACK_ERROR = 0.5;   // pixels, forward-backward tracking
+
+void DriftMonitor::reset (ArenaDetector& detector, const cv::Mat& frame, const ArenaDetection& detection)
+{
+  set_corners(detector, frame, detection.rectangular_points);
+  m_pixel_scale = detection.pixel_scale;
+  std::atomic_store(&m_homography, std::make_shared<const cv::Mat>(detection.persp_transf.clone()));
+}
+
+// Windows centred on the corners, with the undistortion tables of just
+// those pixels: the camera matrix of the undistorted frame, shifted to the
+// origin of each window
+void DriftMonitor::set_corners (ArenaDetector& detector, const cv::Mat& frame, const cv::Mat& corners)
+{
+  m_frame_size = frame.size();
+  m_corners = corners.clone();
+  m_drifted_frames = 0;
+  const cv::Mat& new_camera_matrix = detector.new_camera_matrix(m_frame_size);
+  for (int i=0; i<4; ++i)
+  {
+    m_origin[i] = cv::Point(cvRound(m_corners.at<float>(i,0)) - WINDOW/2,
+                            cvRound(m_corners.at<float>(i,1)) - WINDOW/2);
+    cv::Mat shifted = new_camera_matrix.clone();
+    shifted.at<double>(0,2) -= m_origin[i].x;
+    shifted.at<double>(1,2) -= m_origin[i].y;
+    cv::initUndistortRectifyMap(detector.camera_matrix(), detector.dist_coeffs(), cv::Mat(), shifted,
+                                cv::Size(WINDOW, WINDOW), CV_16SC2, m_map1[i], m_map2[i]);
+    m_reference[i] = window(frame, i);
+    m_drift[i] = cv::Point2f(0, 0);
+  }
+}
+
+cv::Mat DriftMonitor::window (const cv::Mat& frame, int i) const
+{
+  cv::Mat patch, gray;
+  cv::remap(frame, patch, m_map1[i], m_map2[i], cv::INTER_LINEAR);
+  cv::cvtColor(patch, gray, cv::COLOR_BGR2GRAY);
+  return gray;
+}
+
+bool DriftMonitor::check (ArenaDetector& detector, const cv::Mat& frame)
+{
+  if (empty() || frame.size() != m_frame_size)
+    return false;
+  TRACE_SCOPE("drift_check");
+
+  cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, 0.03);
+  cv::Rect_<float> inside(0, 0, WINDOW, WINDOW);
+  int moved = 0;
+  for (int i=0; i<4; ++i)
+  {
+    cv::Mat current = window(frame, i);
+    cv::Point2f corner(m_corners.at<float>(i,0) - m_origin[i].x, m_corners.at<float>(i,1) - m_origin[i].y);
+    std::vector<cv::Point2f> from(1, corner), to(1, corner), back(1, corner);
+    std::vector<uchar> status, back_status;
+    std::vector<float> err;
+    cv::calcOpticalFlowPyrLK(m_reference[i], current, from, to, status, err, cv::Size(21, 21), 2,
+                             criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+    cv::calcOpticalFlowPyrLK(current, m_reference[i], to, back, back_status, err, cv::Size(21, 21), 2,
+                             criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+    cv::Point2f d = back[0] - from[0];
+    if (!status[0] || !back_status[0] || d.dot(d) > MAX_BACK_ERROR * MAX_BACK_ERROR
+        || !inside.contains(to[0]))
+      return false;
+
+    m_drift[i] = to[0] - from[0];
+    if (m_drift[i].dot(m_drift[i]) > DRIFT_THRESHOLD * DRIFT_THRESHOLD)
+      ++moved;
+  }
+
+  if (moved < MIN_MOVED_CORNERS)
+  {
+    m_drifted_frames = 0;
+    return false;
+  }
+  if (++m_drifted_frames < DRIFT_FRAMES)
+    return false;
+
+  // The camera has moved: same arena, seen from the new position
+  cv::Mat corners = m_corners.clone();
+  for (int i=0; i<4; ++i)
+  {
+    corners.at<float>(i,0) += m_drift[i].x;
+    corners.at<float>(i,1) += m_drift[i].y;
+  }
+  cv::Mat persp_transf = arena_transform(corners, m_frame_size, m_pixel_scale);
+  set_corners(detector, frame, corners);
+  std::atomic_store(&m_homography, std::make_shared<const cv::Mat>(persp_transf));
+  return true;
+}
+
+double DriftMonitor::drift () const
+{
+  double largest = 0;
+  for (int i=0; i<4; ++i)
+    largest = std::max(largest, (double)std::sqrt(m_drift[i].dot(m_drift[i])));
+  return largest;
+}
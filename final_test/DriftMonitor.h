@@ -0,0 +1,57 @@
+#ifndef DRIFT_MONITOR_H
+#define DRIFT_MONITOR_H
+
+#include <opencv2/core.hpp>
+#include <memory>
+
+#include "Arena.h"
+
+// Watch for the camera being moved during a run. Each frame, the four
+// border corners are followed by Lucas-Kanade in small windows of the
+// undistorted frame, sampled straight from the raw frame through their own
+// remap tables, so the full frame is never undistorted. When the corners
+// stay displaced past a threshold for a few frames, the arena homography is
+// recomputed from the moved corners and published as a new immutable
+// matrix: readers on other threads get either the old or the new one,
+// never a half-written one.
+class DriftMonitor
+{
+	private:
+		static const int WINDOW = 64;             // undistorted frame pixels, around each corner
+
+		cv::Size m_frame_size;
+		cv::Mat m_corners;                        // 4x2 CV_32F, undistorted frame
+		double m_pixel_scale;
+		cv::Point m_origin[4];                    // top-left of the windows
+		cv::Mat m_map1[4], m_map2[4];             // raw frame -> window
+		cv::Mat m_reference[4];                   // gray windows when the corners were set
+		cv::Point2f m_drift[4];                   // displacement in the last frame
+		int m_drifted_frames;
+		std::shared_ptr<const cv::Mat> m_homography;
+
+		void set_corners(ArenaDetector& detector, const cv::Mat& frame, const cv::Mat& corners);
+		cv::Mat window(const cv::Mat& frame, int i) const;
+
+	public:
+		DriftMonitor() : m_pixel_scale(0), m_drifted_frames(0) { }
+
+		// Follow the corners of a detection on the raw frame it came from
+		void reset(ArenaDetector& detector, const cv::Mat& frame, const ArenaDetection& detection);
+
+		// True when the camera has moved and the homography, corners and pixel
+		// scale were replaced; a corner hidden by the robot postpones the check
+		bool check(ArenaDetector& detector, const cv::Mat& frame);
+
+		bool empty() const { return m_corners.empty(); }
+		const cv::Mat& corners() const { return m_corners; }
+		double pixel_scale() const { return m_pixel_scale; }
+
+		// Latest undistorted frame -> top view transformation; safe to call
+		// from any thread while check() runs
+		std::shared_ptr<const cv::Mat> homography() const { return std::atomic_load(&m_homography); }
+
+		// Largest corner displacement measured in the last frame, in pixels
+		double drift() const;
+};
+
+#endif
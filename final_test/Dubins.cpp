@@ -1,4 +1,6 @@
 #include "Dubins.h"
+#include "Trace.h"
+#include "LatencyStats.h"
 #include "math.h"
 #include <iostream>
 
@@ -27,6 +29,7 @@ curve::curve(arc a, arc b, arc c, double l) {
 
 
 vector<Point2f> cut_arc(arc a, arc b, arc c) {
+	TRACE_SCOPE("dubins_sample");
 	int nr_points = 300;
 	vector<Point2f> list;
 	for (int i = 1; i < 300; i++) {
@@ -260,6 +263,7 @@ void LRL(double sc_th0, double  sc_thf, double  sc_Kmax, bool  *ok, double  *sc_
 
 
 vector<Point2f> dubins(double x0, double y0, double th0, double xf, double yf, double thf, double Kmax) {
+	STAGE_LATENCY(STAGE_PLANNING);
 
 	double *sc_th0 = new double(0), *sc_thf = new double(0), *sc_Kmax = new double(0), *lambda = new double(0);
 	double *s1 = new double(0), *s2 = new double(0), *s3 = new double(0);
@@ -269,12 +273,16 @@ vector<Point2f> dubins(double x0, double y0, double th0, double xf, double yf, d
 	bool *ok = new bool(0);
 	string optimal;
 	
-	// Compute params of standard scaled problem
-	scaleToStandard(x0, y0, th0, xf, yf, thf, Kmax,sc_th0,sc_thf,sc_Kmax,lambda);
-
 	double	pidx = -1;
 	double L = 100000000000000;
 	double Lcur=0;
+
+	{
+	TRACE_SCOPE("dubins_solve");
+
+	// Compute params of standard scaled problem
+	scaleToStandard(x0, y0, th0, xf, yf, thf, Kmax,sc_th0,sc_thf,sc_Kmax,lambda);
+
 	for (int i = 0; i<=5; i++) {
 		switch (i) {
 
@@ -369,6 +377,7 @@ vector<Point2f> dubins(double x0, double y0, double th0, double xf, double yf, d
 
 		}
 	}
+	}
 
 	scaleFromStandard(*lambda, *sc_s1, *sc_s2, *sc_s3, s1, s2, s3);
 	L = *s1 + *s2 + *s3;
@@ -0,0 +1,314 @@
+#include "LatencyStats.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static const char* STAGE_NAMES[STAGE_COUNT] = {
+  "undistort", "segmentation", "obstacles", "ocr", "planning"
+};
+
+
+LatencyHistogram::LatencyHistogram () : count(0), sum_ns(0)
+{
+  for (int i=0; i<BUCKET_COUNT; ++i)
+    counts[i] = 0;
+}
+
+int LatencyHistogram::bucket_of (uint64_t ns)
+{
+  if (ns < (uint64_t)SUB_COUNT)
+    return (int)ns;
+  if (ns >= (1ULL << MAX_EXP))
+    return BUCKET_COUNT - 1;
+
+  int exp = 63 - __builtin_clzll(ns);
+  int sub = (int)((ns >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+  return (exp - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::bucket_lower_ns (int bucket)
+{
+  if (bucket < SUB_COUNT)
+    return (uint64_t)bucket;
+
+  int exp = bucket / SUB_COUNT + SUB_BITS - 1;
+  uint64_t sub = (uint64_t)(bucket % SUB_COUNT);
+  return (SUB_COUNT + sub) << (exp - SUB_BITS);
+}
+
+uint64_t LatencyHistogram::bucket_upper_ns (int bucket)
+{
+  if (bucket < SUB_COUNT)
+    return (uint64_t)bucket + 1;
+
+  int exp = bucket / SUB_COUNT + SUB_BITS - 1;
+  return bucket_lower_ns(bucket) + (1ULL << (exp - SUB_BITS));
+}
+
+void LatencyHistogram::add (uint64_t ns)
+{
+  ++counts[bucket_of(ns)];
+  ++count;
+  sum_ns += ns;
+}
+
+void LatencyHistogram::merge (const LatencyHistogram& other)
+{
+  for (int i=0; i<BUCKET_COUNT; ++i)
+    counts[i] += other.counts[i];
+  count += other.count;
+  sum_ns += other.sum_ns;
+}
+
+double LatencyHistogram::quantile_ns (double q) const
+{
+  if (count == 0) return 0;
+
+  uint64_t rank = (uint64_t)(q * (count - 1)) + 1;
+  uint64_t seen = 0;
+  for (int i=0; i<BUCKET_COUNT; ++i)
+  {
+    seen += counts[i];
+    if (seen >= rank)
+      return 0.5 * (bucket_lower_ns(i) + bucket_upper_ns(i));
+  }
+  return (double)bucket_upper_ns(BUCKET_COUNT - 1);
+}
+
+
+// Buckets of one recording thread. Only the owner writes them, so an
+// increment is a relaxed load and store (no locked instruction); readers
+// may see a sample late, but never a torn counter.
+struct ThreadBuckets
+{
+  std::atomic<uint64_t> counts[STAGE_COUNT][LatencyHistogram::BUCKET_COUNT];
+  std::atomic<uint64_t> count[STAGE_COUNT];
+  std::atomic<uint64_t> sum_ns[STAGE_COUNT];
+
+  ThreadBuckets()
+  {
+    for (int s=0; s<STAGE_COUNT; ++s)
+    {
+      for (int i=0; i<LatencyHistogram::BUCKET_COUNT; ++i)
+        counts[s][i].store(0);
+      count[s].store(0);
+      sum_ns[s].store(0);
+    }
+  }
+};
+
+static inline void bump (std::atomic<uint64_t>& a, uint64_t v)
+{
+  a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+// The buckets outlive their thread, so samples of finished workers are kept
+static std::mutex s_registry_mutex;
+static std::vector<std::unique_ptr<ThreadBuckets>> s_buckets;
+static thread_local ThreadBuckets* t_buckets = nullptr;
+
+// Stages of the frame being measured on this thread
+struct FrameSamples
+{
+  int depth;                      // open frame scopes
+  int stage_depth[STAGE_COUNT];   // open scopes of each stage
+  bool ran[STAGE_COUNT];
+  uint64_t ns[STAGE_COUNT];
+};
+static thread_local FrameSamples t_frame;
+
+static std::mutex s_exporter_mutex;
+static std::condition_variable s_exporter_cv;
+static std::thread s_exporter;
+static bool s_exporter_stop = false;
+
+
+const char* LatencyStats::stage_name (Stage stage)
+{
+  return STAGE_NAMES[stage];
+}
+
+void LatencyStats::record (Stage stage, uint64_t ns)
+{
+  if (t_buckets == nullptr)
+  {
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+    s_buckets.emplace_back(new ThreadBuckets());
+    t_buckets = s_buckets.back().get();
+  }
+
+  bump(t_buckets->counts[stage][LatencyHistogram::bucket_of(ns)], 1);
+  bump(t_buckets->count[stage], 1);
+  bump(t_buckets->sum_ns[stage], ns);
+}
+
+bool LatencyStats::enter (Stage stage)
+{
+  return t_frame.stage_depth[stage]++ == 0;
+}
+
+void LatencyStats::leave (Stage stage, bool outer, uint64_t ns)
+{
+  --t_frame.stage_depth[stage];
+  if (!outer)
+    return;
+  if (t_frame.depth == 0)
+  {
+    record(stage, ns);
+    return;
+  }
+  t_frame.ran[stage] = true;
+  t_frame.ns[stage] += ns;
+}
+
+void LatencyStats::begin_frame ()
+{
+  if (t_frame.depth++ > 0)
+    return;
+  for (int s=0; s<STAGE_COUNT; ++s)
+  {
+    t_frame.ran[s] = false;
+    t_frame.ns[s] = 0;
+  }
+}
+
+void LatencyStats::end_frame ()
+{
+  if (--t_frame.depth > 0)
+    return;
+  for (int s=0; s<STAGE_COUNT; ++s)
+    if (t_frame.ran[s])
+      record((Stage)s, t_frame.ns[s]);
+}
+
+void LatencyStats::snapshot (LatencyHistogram histograms[STAGE_COUNT])
+{
+  for (int s=0; s<STAGE_COUNT; ++s)
+    histograms[s] = LatencyHistogram();
+
+  std::lock_guard<std::mutex> lock(s_registry_mutex);
+  for (auto& buckets : s_buckets)
+  {
+    for (int s=0; s<STAGE_COUNT; ++s)
+    {
+      for (int i=0; i<LatencyHistogram::BUCKET_COUNT; ++i)
+        histograms[s].counts[i] += buckets->counts[s][i].load(std::memory_order_relaxed);
+      histograms[s].count += buckets->count[s].load(std::memory_order_relaxed);
+      histograms[s].sum_ns += buckets->sum_ns[s].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+// Only meant to be called while no stage is being recorded (e.g. between
+// two runs of the regression harness)
+void LatencyStats::reset ()
+{
+  std::lock_guard<std::mutex> lock(s_registry_mutex);
+  for (auto& buckets : s_buckets)
+  {
+    for (int s=0; s<STAGE_COUNT; ++s)
+    {
+      for (int i=0; i<LatencyHistogram::BUCKET_COUNT; ++i)
+        buckets->counts[s][i].store(0);
+      buckets->count[s].store(0);
+      buckets->sum_ns[s].store(0);
+    }
+  }
+}
+
+void LatencyStats::write_prometheus (const std::string& filename)
+{
+  static const double QUANTILES[] = { 0.5, 0.95, 0.99 };
+
+  LatencyHistogram histograms[STAGE_COUNT];
+  snapshot(histograms);
+
+  std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream out(tmp_filename.c_str());
+    if (!out.is_open())
+    {
+      throw std::runtime_error("Could not open file " + tmp_filename);
+    }
+
+    out << "# HELP arena_stage_latency_seconds Latency of the arena pipeline stages.\n"
+        << "# TYPE arena_stage_latency_seconds summary\n";
+    out << std::setprecision(9);
+    for (int s=0; s<STAGE_COUNT; ++s)
+    {
+      for (double q : QUANTILES)
+      {
+        out << "arena_stage_latency_seconds{stage=\"" << STAGE_NAMES[s]
+            << "\",quantile=\"" << q << "\"} ";
+        if (histograms[s].count == 0)
+          out << "NaN\n";
+        else
+          out << histograms[s].quantile_ns(q) * 1e-9 << "\n";
+      }
+      out << "arena_stage_latency_seconds_sum{stage=\"" << STAGE_NAMES[s] << "\"} "
+          << histograms[s].sum_ns * 1e-9 << "\n";
+      out << "arena_stage_latency_seconds_count{stage=\"" << STAGE_NAMES[s] << "\"} "
+          << histograms[s].count << "\n";
+    }
+  }
+  std::rename(tmp_filename.c_str(), filename.c_str());
+}
+
+void LatencyStats::print_summary (std::ostream& out)
+{
+  LatencyHistogram histograms[STAGE_COUNT];
+  snapshot(histograms);
+
+  out << std::left << std::setw(14) << "stage" << std::right
+      << std::setw(8) << "count" << std::setw(12) << "p50 [ms]"
+      << std::setw(12) << "p95 [ms]" << std::setw(12) << "p99 [ms]" << std::endl;
+  out << std::fixed << std::setprecision(3);
+  for (int s=0; s<STAGE_COUNT; ++s)
+  {
+    out << std::left << std::setw(14) << STAGE_NAMES[s] << std::right
+        << std::setw(8) << histograms[s].count
+        << std::setw(12) << histograms[s].quantile_ns(0.5) * 1e-6
+        << std::setw(12) << histograms[s].quantile_ns(0.95) * 1e-6
+        << std::setw(12) << histograms[s].quantile_ns(0.99) * 1e-6 << std::endl;
+  }
+  out.unsetf(std::ios::fixed);
+}
+
+void LatencyStats::start_exporter (const std::string& filename, int period_ms)
+{
+  stop_exporter();
+  s_exporter_stop = false;
+  s_exporter = std::thread([filename, period_ms]() {
+    std::unique_lock<std::mutex> lock(s_exporter_mutex);
+    while (!s_exporter_stop)
+    {
+      s_exporter_cv.wait_for(lock, std::chrono::milliseconds(period_ms));
+      try {
+        write_prometheus(filename);
+      }
+      catch (const std::exception& e) {
+        std::cerr << "Latency export failed: " << e.what() << std::endl;
+      }
+    }
+  });
+}
+
+void LatencyStats::stop_exporter ()
+{
+  if (!s_exporter.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(s_exporter_mutex);
+    s_exporter_stop = true;
+  }
+  s_exporter_cv.notify_all();
+  s_exporter.join();
+}
@@ -0,0 +1,114 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+// Latency distributions of the pipeline stages.
+// Each STAGE_LATENCY scope adds one sample to a log-linear (HDR-style)
+// histogram of its stage. Samples go to buckets owned by the recording
+// thread, so the hot path is two clock reads and two uncontended relaxed
+// stores; snapshot() merges the buckets of all threads when an export is due.
+// Inside a FRAME_LATENCY scope the stages are per frame instead: the time
+// of all the scopes of a stage is summed, and each stage that ran adds one
+// sample when the outermost frame scope closes. A stage scope nested in
+// another one of the same stage is not counted twice.
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+enum Stage
+{
+	STAGE_UNDISTORT,
+	STAGE_SEGMENTATION,
+	STAGE_OBSTACLES,
+	STAGE_OCR,
+	STAGE_PLANNING,
+	STAGE_COUNT
+};
+
+class LatencyHistogram
+{
+	public:
+		// 16 sub-buckets for every power of two: values are kept with a
+		// relative error below 1/16, from 1 ns up to 2^MAX_EXP ns (~18 min)
+		static const int SUB_BITS = 4;
+		static const int SUB_COUNT = 1 << SUB_BITS;
+		static const int MAX_EXP = 40;
+		static const int BUCKET_COUNT = (MAX_EXP - SUB_BITS + 1) * SUB_COUNT;
+
+		uint64_t counts[BUCKET_COUNT];
+		uint64_t count;
+		uint64_t sum_ns;
+
+		LatencyHistogram();
+
+		static int bucket_of(uint64_t ns);
+		static uint64_t bucket_lower_ns(int bucket);
+		static uint64_t bucket_upper_ns(int bucket);
+
+		void add(uint64_t ns);
+		void merge(const LatencyHistogram& other);
+
+		// q in [0, 1]; returns the midpoint of the bucket holding the quantile
+		double quantile_ns(double q) const;
+};
+
+class LatencyStats
+{
+	public:
+		static const char* stage_name(Stage stage);
+
+		static void record(Stage stage, uint64_t ns);
+
+		// Used by the scopes below: enter returns whether the scope is the
+		// outermost one of its stage on the thread
+		static bool enter(Stage stage);
+		static void leave(Stage stage, bool outer, uint64_t ns);
+		static void begin_frame();
+		static void end_frame();
+
+		// Merge the buckets of every thread that has recorded a sample
+		static void snapshot(LatencyHistogram histograms[STAGE_COUNT]);
+		static void reset();
+
+		// Prometheus text exposition format (summary with p50/p95/p99);
+		// the file is replaced atomically, so a scraper never reads half of it
+		static void write_prometheus(const std::string& filename);
+		static void print_summary(std::ostream& out);
+
+		// Background thread that rewrites the export file every period_ms
+		static void start_exporter(const std::string& filename, int period_ms);
+		static void stop_exporter();
+
+		static uint64_t now_ns()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+};
+
+class StageTimer
+{
+	private:
+		Stage m_stage;
+		bool m_outer;
+		uint64_t m_begin;
+
+	public:
+		StageTimer(Stage stage) : m_stage(stage), m_outer(LatencyStats::enter(stage)), m_begin(LatencyStats::now_ns()) { }
+		~StageTimer() { LatencyStats::leave(m_stage, m_outer, LatencyStats::now_ns() - m_begin); }
+};
+
+class FrameTimer
+{
+	public:
+		FrameTimer() { LatencyStats::begin_frame(); }
+		~FrameTimer() { LatencyStats::end_frame(); }
+};
+
+#define STAGE_LATENCY_CONCAT_(a, b) a##b
+#define STAGE_LATENCY_CONCAT(a, b) STAGE_LATENCY_CONCAT_(a, b)
+#define STAGE_LATENCY(stage) StageTimer STAGE_LATENCY_CONCAT(stage_timer_, __LINE__)(stage)
+#define FRAME_LATENCY() FrameTimer STAGE_LATENCY_CONCAT(frame_timer_, __LINE__)
+
+#endif
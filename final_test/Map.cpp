@@ -1,82 +1,262 @@
 #include <opencv2/core.hpp>
 #include <opencv2/opencv.hpp>
-#include <iostream>
+#include <stdexcept>
 
 #include "Map.h"
+#include "Segmentation.h"
+#include "Trace.h"
+#include "LatencyStats.h"
 
+static const double MIN_MATCH_OVERLAP = 0.3;  // intersection over union of the old and new boxes
 
-Map::Map (cv::Mat image) : m_img_rgb(image), m_obstacles()
-{
 
-  cv::Mat img_hsv;
-  cv::cvtColor(image, img_hsv, cv::COLOR_BGR2HSV);
-  find_obstacles(img_hsv);
+Map::Map (const ColorConfig& colors) : m_colors(colors), m_version(0)
+{
+}
 
+Map::Map (const cv::Mat& image, const ColorConfig& colors) : m_colors(colors), m_version(0)
+{
+  update(image);
 }
 
 
-void Map::find_obstacles(cv::Mat image)
+std::vector<cv::Rect> Map::find_obstacles(const cv::Mat& image) const
 {
-  //Color Mask
-  cv::Mat low_hue_red_mask;
-  cv::Mat high_hue_red_mask;
-  cv::Mat red_mask;
-  
-  cv::inRange(image, cv::Scalar(LOW_H_R, LOW_S_R, LOW_V_R), cv::Scalar(M1_H_R, HIGH_S_R, HIGH_V_R), low_hue_red_mask);
-  cv::inRange(image, cv::Scalar(M1_H_R, LOW_S_R, LOW_V_R), cv::Scalar(HIGH_H_R, HIGH_S_R, HIGH_V_R), high_hue_red_mask);
-  cv::addWeighted(low_hue_red_mask, 1.0, high_hue_red_mask, 1.0, 0.0, red_mask); // combine together the two binary masks
-  
+  // Both halves of the red hue go in the same mask, in one pass over bands
+  // of rows
+  const std::vector<HsvRange>& red = m_colors.ranges("map_obstacle");
+  MaskSpec red_spec = { &red[0], (int)red.size(), 1 };
+  std::vector<cv::Mat> masks;
+  {
+    TRACE_SCOPE("obstacle_masks");
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    segment_masks(image, std::vector<MaskSpec>(1, red_spec), masks);
+  }
 
   std::vector<std::vector<cv::Point>> contours;
   std::vector<cv::Point> approx_curve;
-  cv::Rect rect;
-      
+  std::vector<cv::Rect> boxes;
 
   // Find contours and approximate in bounding boxes
-  cv::findContours(red_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  {
+    TRACE_SCOPE("obstacle_contours");
+    STAGE_LATENCY(STAGE_OBSTACLES);
+    cv::findContours(masks[0], contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  }
 
   for (int i=0; i<contours.size(); ++i)
   {
-    if (contours[i].size() > MIN_OBSTACLE_CONTOUR_SIZE) { 
+    if (contours[i].size() > MIN_OBSTACLE_CONTOUR_SIZE) {
       approxPolyDP(contours[i], approx_curve, 10, true);
+      boxes.push_back(cv::boundingRect(approx_curve));
+    }
+  }
+  return boxes;
+}
+
+static double overlap(const cv::Rect& a, const cv::Rect& b)
+{
+  int inter = (a & b).area();
+  return inter > 0 ? (double)inter / (a.area() + b.area() - inter) : 0;
+}
 
-      rect = cv::boundingRect({approx_curve});
-      cv::rectangle(image, rect, cv::Scalar(40,190,40), 2);
-      Obstacle obstacle(rect);
-      m_obstacles.push_back(obstacle);
-    } 
+// Known box not matched yet that overlaps box the most, -1 if none
+// overlaps it enough
+static int best_match(const cv::Rect& box, const std::vector<cv::Rect>& known, const std::vector<bool>& matched)
+{
+  int best = -1;
+  double best_overlap = MIN_MATCH_OVERLAP;
+  for (int j=0; j<known.size(); ++j)
+  {
+    double o = matched[j] ? 0 : overlap(box, known[j]);
+    if (o >= best_overlap)
+    {
+      best = j;
+      best_overlap = o;
+    }
   }
+  return best;
+}
 
-  imshow("path",image);
+static MapDelta make_delta(MapDelta::Kind kind, MapDelta::Object object, int id, const cv::Rect& bbox, int digit)
+{
+  MapDelta delta;
+  delta.kind = kind;
+  delta.object = object;
+  delta.id = id;
+  delta.bbox = bbox;
+  delta.digit = digit;
+  return delta;
 }
 
+// New boxes overlapping a known one are the same obstacle, moved if the
+// box differs; the others are added, and the known ones left are removed
+void Map::diff_obstacles (const std::vector<cv::Rect>& boxes, std::vector<MapDelta>& deltas) const
+{
+  std::vector<cv::Rect> known;
+  for (int j=0; j<m_obstacles.size(); ++j)
+    known.push_back(m_obstacles[j].get_bounding_box());
+  std::vector<bool> matched(known.size(), false);
 
+  for (int i=0; i<boxes.size(); ++i)
+  {
+    int j = best_match(boxes[i], known, matched);
+    if (j < 0)
+      deltas.push_back(make_delta(MapDelta::ADD, MapDelta::OBSTACLE, -1, boxes[i], -1));
+    else
+    {
+      matched[j] = true;
+      if (boxes[i] != known[j])
+        deltas.push_back(make_delta(MapDelta::MOVE, MapDelta::OBSTACLE, m_obstacles[j].get_id(), boxes[i], -1));
+    }
+  }
+  for (int j=0; j<known.size(); ++j)
+    if (!matched[j])
+      deltas.push_back(make_delta(MapDelta::REMOVE, MapDelta::OBSTACLE, m_obstacles[j].get_id(), known[j], -1));
+}
 
-int main(int argc, char* argv[])
+// Same matching for the victims; a digit the OCR missed this time keeps
+// the one read before
+void Map::diff_victims (const std::vector<Victim>& victims, std::vector<MapDelta>& deltas) const
 {
+  std::vector<cv::Rect> known;
+  for (int j=0; j<m_victims.size(); ++j)
+    known.push_back(m_victims[j].bbox);
+  std::vector<bool> matched(known.size(), false);
 
-  cv::Mat img;
-  img = cv::imread(argv[1], 1); //reading file
-  
-  if(img.empty()) {
-    throw std::runtime_error("Failed to open the file ");
+  for (int i=0; i<victims.size(); ++i)
+  {
+    const Victim& v = victims[i];
+    int j = best_match(v.bbox, known, matched);
+    if (j < 0)
+      deltas.push_back(make_delta(MapDelta::ADD, MapDelta::VICTIM, -1, v.bbox, v.digit));
+    else
+    {
+      matched[j] = true;
+      int digit = v.digit >= 0 ? v.digit : m_victims[j].digit;
+      if (v.bbox != known[j] || digit != m_victims[j].digit)
+        deltas.push_back(make_delta(MapDelta::MOVE, MapDelta::VICTIM, m_victims[j].id, v.bbox, digit));
+    }
   }
+  for (int j=0; j<known.size(); ++j)
+    if (!matched[j])
+      deltas.push_back(make_delta(MapDelta::REMOVE, MapDelta::VICTIM, m_victims[j].id, known[j], -1));
+}
 
-  Map map(img);
+std::vector<MapDelta> Map::update (const cv::Mat& image)
+{
+  TRACE_SCOPE("map_update");
+  FRAME_LATENCY();
+  std::vector<MapDelta> deltas;
+  diff_obstacles(find_obstacles(image), deltas);
+  apply(deltas);
+  return deltas;
+}
 
+std::vector<MapDelta> Map::update (const ArenaDetection& detection)
+{
+  TRACE_SCOPE("map_update");
+  FRAME_LATENCY();
+  std::vector<MapDelta> deltas;
+  diff_obstacles(detection.obstacles, deltas);
+  diff_victims(detection.victims, deltas);
+  if (detection.gate != m_gate)
+  {
+    deltas.push_back(make_delta(MapDelta::MOVE, MapDelta::GATE, -1, cv::boundingRect(detection.gate), -1));
+    deltas.back().gate = detection.gate;
+  }
+  apply(deltas);
+  return deltas;
+}
 
-  vector<Point2f> trajectory;
-  trajectory = dubins(0, 0, (((double(-9) / double(2))) * PI), 600, 600, (PI / double(1)), 1);
+int Map::slot (int id, MapDelta::Object object) const
+{
+  int s = id >= 0 && id < m_slots.size() ? m_slots[id] : -1;
+  if (s < 0) return -1;
+  if (object == MapDelta::OBSTACLE)
+    return s < m_obstacles.size() && m_obstacles[s].get_id() == id ? s : -1;
+  return s < m_victims.size() && m_victims[s].id == id ? s : -1;
+}
 
-  std::cout << trajectory << std::endl;
+int Map::add (MapDelta& delta)
+{
+  delta.id = m_slots.size();
+  if (delta.object == MapDelta::OBSTACLE)
+  {
+    m_slots.push_back(m_obstacles.size());
+    m_obstacles.push_back(Obstacle(delta.id, delta.bbox));
+  }
+  else
+  {
+    MapVictim victim = { delta.id, delta.bbox, delta.digit };
+    m_slots.push_back(m_victims.size());
+    m_victims.push_back(victim);
+  }
+  return delta.id;
+}
 
-/*
-  for (auto i : trajectory) {
-    Point2i point = i;
-    cv::circle(img, point, 2, cv::Scalar(40,190,40));
+// The last object takes the place of the removed one, so the arrays stay
+// contiguous; only its slot changes, not its id
+void Map::remove (const MapDelta& delta)
+{
+  int s = m_slots[delta.id];
+  if (delta.object == MapDelta::OBSTACLE)
+  {
+    m_obstacles[s] = m_obstacles.back();
+    m_slots[m_obstacles[s].get_id()] = s;
+    m_obstacles.pop_back();
   }
+  else
+  {
+    m_victims[s] = m_victims.back();
+    m_slots[m_victims[s].id] = s;
+    m_victims.pop_back();
+  }
+  m_slots[delta.id] = -1;
+}
+
+void Map::apply (std::vector<MapDelta>& deltas)
+{
+  for (int i=0; i<deltas.size(); ++i)
+  {
+    MapDelta& delta = deltas[i];
+    if (delta.object == MapDelta::GATE)
+    {
+      if (delta.kind == MapDelta::REMOVE) m_gate.clear();
+      else m_gate = delta.gate;
+      continue;
+    }
+    if (delta.kind == MapDelta::ADD)
+    {
+      add(delta);
+      continue;
+    }
 
-  imshow("path",img);
-  */waitKey(0);
+    int s = slot(delta.id, delta.object);
+    if (s < 0)
+      throw std::runtime_error("Map delta for an unknown object id " + std::to_string(delta.id));
+    if (delta.kind == MapDelta::REMOVE)
+      remove(delta);
+    else if (delta.object == MapDelta::OBSTACLE)
+      m_obstacles[s].set_bounding_box(delta.bbox);
+    else
+    {
+      m_victims[s].bbox = delta.bbox;
+      m_victims[s].digit = delta.digit;
+    }
+  }
+  if (!deltas.empty())
+    ++m_version;
+}
+
+const Obstacle* Map::find_obstacle (int id) const
+{
+  int s = slot(id, MapDelta::OBSTACLE);
+  return s < 0 ? NULL : &m_obstacles[s];
+}
 
+const MapVictim* Map::find_victim (int id) const
+{
+  int s = slot(id, MapDelta::VICTIM);
+  return s < 0 ? NULL : &m_victims[s];
 }
@@ -2,31 +2,81 @@
 #define MAP_H
 
 #include <opencv2/core.hpp>
+#include <stdint.h>
+#include <vector>
 
+#include "Arena.h"
+#include "ColorConfig.h"
 #include "Obstacle.h"
-#include "Dubins.h"
 
+struct MapVictim
+{
+	int id;
+	cv::Rect bbox;
+	int digit;            // -1 until the OCR returns a digit
+};
+
+// One change of the map. Ids are given by the map when an object is added
+// and never reused, so a planner can keep them across updates.
+struct MapDelta
+{
+	enum Kind { ADD, MOVE, REMOVE };
+	enum Object { OBSTACLE, VICTIM, GATE };
+
+	Kind kind;
+	Object object;
+	int id;                           // set by apply() for ADD
+	cv::Rect bbox;                    // new box of ADD and MOVE
+	int digit;                        // victims
+	std::vector<cv::Point> gate;      // new polygon of a GATE MOVE
+};
+
+// World model kept up to date from frames or detections: each update is
+// turned into the add/move/remove deltas of the objects that changed, and
+// only those are applied to the flat arrays of obstacles and victims. The
+// version goes up with every update that changed something, so a planner
+// can skip its work when it has not.
 class Map
 {
 	private:
 		static const int MIN_OBSTACLE_CONTOUR_SIZE = 60;
 
-		static const int LOW_H_R   = 0;
-		static const int LOW_S_R   = 85;
-		static const int LOW_V_R   = 175;
-		static const int HIGH_H_R  = 180;
-		static const int HIGH_S_R  = 140;
-		static const int HIGH_V_R  = 255;
-		static const int M1_H_R    = 5;
-		static const int M2_H_R    = 170;
+		ColorConfig m_colors;
+		std::vector<Obstacle> m_obstacles;
+		std::vector<MapVictim> m_victims;
+		std::vector<cv::Point> m_gate;
+		std::vector<int> m_slots;         // id -> index in its array, -1 once removed
+		uint64_t m_version;
 
-		const cv::Mat m_img_rgb;
-		std::list<Obstacle> m_obstacles;
-
-		void find_obstacles(cv::Mat image);
+		std::vector<cv::Rect> find_obstacles(const cv::Mat& image) const;
+		void diff_obstacles(const std::vector<cv::Rect>& boxes, std::vector<MapDelta>& deltas) const;
+		void diff_victims(const std::vector<Victim>& victims, std::vector<MapDelta>& deltas) const;
+		int slot(int id, MapDelta::Object object) const;
+		int add(MapDelta& delta);
+		void remove(const MapDelta& delta);
 
 	public:
-		Map(cv::Mat image);
+		// Obstacles are the "map_obstacle" colour class
+		explicit Map(const ColorConfig& colors = ColorConfig::defaults());
+		Map(const cv::Mat& image, const ColorConfig& colors = ColorConfig::defaults());
+
+		// Obstacles of a new top view; victims and gate are left as they are
+		std::vector<MapDelta> update(const cv::Mat& image);
+
+		// Every object of a detection of the arena pipeline
+		std::vector<MapDelta> update(const ArenaDetection& detection);
+
+		// Deltas in order; the ids of the added objects are written back
+		void apply(std::vector<MapDelta>& deltas);
+
+		uint64_t version() const { return m_version; }
+		const std::vector<Obstacle>& obstacles() const { return m_obstacles; }
+		const std::vector<MapVictim>& victims() const { return m_victims; }
+		const std::vector<cv::Point>& gate() const { return m_gate; }
+
+		// NULL when there is no such object, or it was removed
+		const Obstacle* find_obstacle(int id) const;
+		const MapVictim* find_victim(int id) const;
 };
 
-#endif
\ No newline at end of file
+#endif
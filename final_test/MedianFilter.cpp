@@ -0,0 +1,249 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#include "MedianFilter.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Columns filtered together: their histograms stay in the L2 cache
+static const int STRIP_COLS = 256;
+// Up to 5x5 the sorting network of cv::medianBlur is faster
+static const int MAX_SORTING_KSIZE = 5;
+
+// Two-level histogram of the 2r+1 values of a column, r < 128:
+// coarse[v>>4] and fine[v>>4][v&15]
+struct ColumnHistogram
+{
+  uchar coarse[16];
+  uchar fine[16][16];
+};
+
+// Histogram of the whole kernel
+struct KernelHistogram
+{
+  uint16_t coarse[16];
+  uint16_t fine[16][16];
+};
+
+// h += plus - minus, on 16 bins
+static inline void add_sub16(uint16_t* h, const uchar* plus, const uchar* minus)
+{
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i p = _mm_loadu_si128((const __m128i*)plus);
+  __m128i m = _mm_loadu_si128((const __m128i*)minus);
+  __m128i lo = _mm_loadu_si128((const __m128i*)h);
+  __m128i hi = _mm_loadu_si128((const __m128i*)(h + 8));
+  lo = _mm_sub_epi16(_mm_add_epi16(lo, _mm_unpacklo_epi8(p, zero)), _mm_unpacklo_epi8(m, zero));
+  hi = _mm_sub_epi16(_mm_add_epi16(hi, _mm_unpackhi_epi8(p, zero)), _mm_unpackhi_epi8(m, zero));
+  _mm_storeu_si128((__m128i*)h, lo);
+  _mm_storeu_si128((__m128i*)(h + 8), hi);
+#else
+  for (int i=0; i<16; ++i)
+    h[i] += plus[i] - minus[i];
+#endif
+}
+
+// h += a, on 16 bins
+static inline void add16(uint16_t* h, const uchar* a)
+{
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i v = _mm_loadu_si128((const __m128i*)a);
+  __m128i lo = _mm_loadu_si128((const __m128i*)h);
+  __m128i hi = _mm_loadu_si128((const __m128i*)(h + 8));
+  _mm_storeu_si128((__m128i*)h, _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero)));
+  _mm_storeu_si128((__m128i*)(h + 8), _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero)));
+#else
+  for (int i=0; i<16; ++i)
+    h[i] += a[i];
+#endif
+}
+
+// First bin i of h such that below + h[0] + ... + h[i] > rank; below is
+// advanced to the count of the bins before it
+static inline int find_rank(const uint16_t* h, int rank, int& below)
+{
+#if defined(__SSE2__)
+  // Prefix sums of the two halves, compared as unsigned 16-bit values
+  __m128i lo = _mm_loadu_si128((const __m128i*)h);
+  __m128i hi = _mm_loadu_si128((const __m128i*)(h + 8));
+  lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 2));
+  hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 2));
+  lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+  hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+  lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+  hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+  __m128i total_lo = _mm_shufflehi_epi16(lo, 0xff);
+  hi = _mm_add_epi16(hi, _mm_unpackhi_epi64(total_lo, total_lo));
+
+  const __m128i sign = _mm_set1_epi16((short)0x8000);
+  __m128i limit = _mm_set1_epi16((short)((rank - below) ^ 0x8000));
+  int above = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_xor_si128(lo, sign), limit))
+            | _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_xor_si128(hi, sign), limit)) << 16;
+  int i = __builtin_ctz(above) / 2;
+
+  uint16_t prefix[16];
+  _mm_storeu_si128((__m128i*)prefix, lo);
+  _mm_storeu_si128((__m128i*)(prefix + 8), hi);
+  if (i > 0) below += prefix[i-1];
+  return i;
+#else
+  int i = 0;
+  while (below + h[i] <= rank)
+    below += h[i++];
+  return i;
+#endif
+}
+
+static inline void add_value(ColumnHistogram& h, uchar v, int n)
+{
+  h.coarse[v >> 4] += n;
+  h.fine[v >> 4][v & 15] += n;
+}
+
+// Filter the rows [begin, end) and columns [x0, x1) of one channel. Rows and
+// columns outside the image are replicated from the border, as in
+// cv::medianBlur. columns[l] is the histogram of image column x0-r+l.
+static void median_tile(const cv::Mat& src, cv::Mat& dst, int channel, int r,
+                        int begin, int end, int x0, int x1,
+                        std::vector<ColumnHistogram>& columns)
+{
+  int rows = src.rows, cols = src.cols, cn = src.channels();
+  int k = 2*r + 1;
+  int rank = k*k / 2;        // the median is the value with rank elements below it
+  int n = x1 - x0 + 2*r;
+  columns.resize(n);
+  std::memset(&columns[0], 0, n * sizeof(ColumnHistogram));
+
+  // Image column read by each histogram
+  std::vector<int> source(n);
+  for (int l=0; l<n; ++l)
+    source[l] = (std::min(std::max(x0 - r + l, 0), cols - 1))*cn + channel;
+
+  // Column histograms of the window of the first row
+  for (int dy=-r; dy<=r; ++dy)
+  {
+    const uchar* row = src.ptr<uchar>(std::min(std::max(begin + dy, 0), rows - 1));
+    for (int l=0; l<n; ++l)
+      add_value(columns[l], row[source[l]], 1);
+  }
+
+  KernelHistogram kernel;
+  int last_update[16];        // column at which each fine histogram of the kernel is up to date
+  for (int y=begin; y<end; ++y)
+  {
+    if (y > begin)
+    {
+      const uchar* out_row = src.ptr<uchar>(std::max(y - r - 1, 0));
+      const uchar* in_row = src.ptr<uchar>(std::min(y + r, rows - 1));
+      if (out_row != in_row)
+      {
+        for (int l=0; l<n; ++l)
+        {
+          add_value(columns[l], out_row[source[l]], -1);
+          add_value(columns[l], in_row[source[l]], 1);
+        }
+      }
+    }
+
+    // Coarse histogram of the kernel at x0, covering columns[0..k); the
+    // fine ones are only brought up to date when their coarse bin holds
+    // the median
+    std::memset(&kernel, 0, sizeof(kernel));
+    for (int l=0; l<k; ++l)
+      add16(kernel.coarse, columns[l].coarse);
+    std::fill(last_update, last_update + 16, -k - 1);
+
+    uchar* out = dst.ptr<uchar>(y) + channel;
+    for (int i=0; i<x1-x0; ++i)
+    {
+      // The kernel of output column i covers columns[i..i+k)
+      if (i > 0)
+        add_sub16(kernel.coarse, columns[i + k - 1].coarse, columns[i - 1].coarse);
+
+      int below = 0;
+      int b = find_rank(kernel.coarse, rank, below);
+
+      uint16_t* fine = kernel.fine[b];
+      if (i - last_update[b] > k)
+      {
+        std::memset(fine, 0, 16 * sizeof(uint16_t));
+        for (int l=i; l<i+k; ++l)
+          add16(fine, columns[l].fine[b]);
+      }
+      else
+      {
+        for (int j=last_update[b]+1; j<=i; ++j)
+          add_sub16(fine, columns[j + k - 1].fine[b], columns[j - 1].fine[b]);
+      }
+      last_update[b] = i;
+
+      out[(x0 + i)*cn] = (b << 4) | find_rank(fine, rank, below);
+    }
+  }
+}
+
+class MedianBands : public cv::ParallelLoopBody
+{
+  private:
+    const cv::Mat& m_src;
+    cv::Mat& m_dst;
+    int m_radius, m_band_rows;
+
+  public:
+    MedianBands(const cv::Mat& src, cv::Mat& dst, int radius, int band_rows)
+      : m_src(src), m_dst(dst), m_radius(radius), m_band_rows(band_rows) { }
+
+    void operator()(const cv::Range& bands) const
+    {
+      std::vector<ColumnHistogram> columns;
+      for (int band=bands.start; band<bands.end; ++band)
+      {
+        int begin = band * m_band_rows;
+        int end = std::min(begin + m_band_rows, m_src.rows);
+        for (int x0=0; x0<m_src.cols; x0+=STRIP_COLS)
+        {
+          int x1 = std::min(x0 + STRIP_COLS, m_src.cols);
+          for (int c=0; c<m_src.channels(); ++c)
+            median_tile(m_src, m_dst, c, m_radius, begin, end, x0, x1, columns);
+        }
+      }
+    }
+};
+
+void median_filter(const cv::Mat& src, cv::Mat& dst, int ksize)
+{
+  if (src.depth() != CV_8U || src.channels() > 4)
+    throw std::runtime_error("The median filter takes 8-bit images of 1 to 4 channels");
+  if (ksize < 1 || ksize % 2 == 0 || ksize > 255)
+    throw std::runtime_error("The median filter needs an odd kernel size up to 255");
+  if (ksize == 1 || src.empty())
+  {
+    src.copyTo(dst);
+    return;
+  }
+  if (ksize <= MAX_SORTING_KSIZE)
+  {
+    cv::medianBlur(src, dst, ksize);
+    return;
+  }
+
+  // The bands read rows of their neighbours
+  cv::Mat input = src.data == dst.data ? src.clone() : src;
+  dst.create(input.size(), input.type());
+
+  // Each band first fills its column histograms with 2r+1 rows: keep the
+  // bands a few times taller than the kernel
+  int r = ksize / 2;
+  int bands = std::max(1, std::min(cv::getNumThreads(), input.rows / (4*ksize)));
+  int band_rows = (input.rows + bands - 1) / bands;
+  cv::parallel_for_(cv::Range(0, bands), MedianBands(input, dst, r, band_rows));
+}
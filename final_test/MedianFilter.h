@@ -0,0 +1,16 @@
+#ifndef MEDIAN_FILTER_H
+#define MEDIAN_FILTER_H
+
+#include <opencv2/core.hpp>
+
+// Median filter of 8-bit images (1 to 4 channels) with a ksize x ksize
+// square kernel, ksize odd. Same result as cv::medianBlur (replicated
+// border), at a cost per pixel that does not depend on ksize: every column
+// keeps a histogram of its 2r+1 rows, the histogram of the kernel slides
+// along the row by adding one column and removing another, and the median
+// is found in two levels (16 coarse bins, then 16 fine ones).
+// The image is split in bands of rows filtered in parallel. Kernels up to
+// 5x5 are left to cv::medianBlur, whose sorting network is faster there.
+void median_filter(const cv::Mat& src, cv::Mat& dst, int ksize);
+
+#endif
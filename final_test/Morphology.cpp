@@ -0,0 +1,448 @@
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "Morphology.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// For a window of k samples split in blocks of k, the window starting at x
+// is covered by the suffix of its block (h) and the prefix of the next one
+// (g): out[x] = op(h[x], g[x+k-1]).
+
+struct MinOp
+{
+  static const uchar identity = 255;
+  static uchar apply(uchar a, uchar b) { return a < b ? a : b; }
+#if defined(__SSE2__)
+  static __m128i apply(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+#endif
+};
+
+struct MaxOp
+{
+  static const uchar identity = 0;
+  static uchar apply(uchar a, uchar b) { return a > b ? a : b; }
+#if defined(__SSE2__)
+  static __m128i apply(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+#endif
+};
+
+static const int STRIP = 16;
+
+#if defined(__SSE2__)
+// Column of a strip (a bare __m128i loses its alignment attribute in a vector)
+struct Column
+{
+  __m128i v;
+};
+#endif
+
+// Buffers of one pass (vertical then horizontal); the opening and closing
+// run two passes at the same time
+struct PassScratch
+{
+  std::vector<uchar> identity_row, out_row;
+  cv::Mat rows_g, rows_h;
+  cv::Mat strip;
+};
+
+// Scratch buffers, reused by every call of the thread
+struct MorphScratch
+{
+  std::vector<uchar> padded, g, h;
+  PassScratch passes[2];
+  cv::Mat ring;
+  cv::Mat tmp;
+#if defined(__SSE2__)
+  std::vector<Column> columns, vg, vh;
+#endif
+};
+
+static thread_local MorphScratch t_scratch;
+
+// One row, window of k samples anchored at k/2
+template<class Op>
+static void vhgw_row(const uchar* src, uchar* dst, int n, int k)
+{
+  int anchor = k/2;
+  int len = n + k - 1;
+  std::vector<uchar>& p = t_scratch.padded;
+  std::vector<uchar>& g = t_scratch.g;
+  std::vector<uchar>& h = t_scratch.h;
+  p.resize(len); g.resize(len); h.resize(len);
+
+  uchar identity = Op::identity;
+  std::fill(p.begin(), p.begin() + anchor, identity);
+  std::copy(src, src + n, p.begin() + anchor);
+  std::fill(p.begin() + anchor + n, p.end(), identity);
+
+  for (int b=0; b<len; b+=k)
+  {
+    int end = std::min(b + k, len);
+    g[b] = p[b];
+    for (int i=b+1; i<end; ++i)
+      g[i] = Op::apply(g[i-1], p[i]);
+    h[end-1] = p[end-1];
+    for (int i=end-2; i>=b; --i)
+      h[i] = Op::apply(h[i+1], p[i]);
+  }
+  for (int x=0; x<n; ++x)
+    dst[x] = Op::apply(h[x], g[x+k-1]);
+}
+
+#if defined(__SSE2__)
+// In place transpose of a 16x16 block of bytes: four rounds of the same
+// interleaving of rows i and i+8
+static inline void transpose16(__m128i r[16])
+{
+  __m128i t[16];
+  for (int round=0; round<4; ++round)
+  {
+    for (int i=0; i<8; ++i)
+    {
+      t[2*i]   = _mm_unpacklo_epi8(r[i], r[i+8]);
+      t[2*i+1] = _mm_unpackhi_epi8(r[i], r[i+8]);
+    }
+    for (int i=0; i<16; ++i)
+      r[i] = t[i];
+  }
+}
+
+// 16 rows at once: the strip is transposed so that every column becomes one
+// vector, the row algorithm runs on vectors, and the result is transposed back
+template<class Op>
+static void vhgw_strip(const uchar* const src[STRIP], uchar* const dst[STRIP], int count, int n, int k)
+{
+  int anchor = k/2;
+  int len = n + k - 1;
+  uchar identity = Op::identity;
+  __m128i videntity = _mm_set1_epi8((char)identity);
+
+  std::vector<Column>& c = t_scratch.columns;
+  std::vector<Column>& g = t_scratch.vg;
+  std::vector<Column>& h = t_scratch.vh;
+  c.resize(len); g.resize(len); h.resize(len);
+
+  __m128i block[STRIP];
+  for (int i=0; i<anchor; ++i) c[i].v = videntity;
+  for (int i=anchor+n; i<len; ++i) c[i].v = videntity;
+  for (int x0=0; x0<n; x0+=16)
+  {
+    int w = std::min(16, n - x0);
+    for (int r=0; r<STRIP; ++r)
+    {
+      if (w == 16)
+        block[r] = _mm_loadu_si128((const __m128i*)(src[r] + x0));
+      else
+      {
+        uchar tail[16];
+        std::fill(tail, tail + 16, identity);
+        std::copy(src[r] + x0, src[r] + x0 + w, tail);
+        block[r] = _mm_loadu_si128((const __m128i*)tail);
+      }
+    }
+    transpose16(block);
+    for (int i=0; i<w; ++i)
+      c[anchor + x0 + i].v = block[i];
+  }
+
+  for (int b=0; b<len; b+=k)
+  {
+    int end = std::min(b + k, len);
+    g[b].v = c[b].v;
+    for (int i=b+1; i<end; ++i)
+      g[i].v = Op::apply(g[i-1].v, c[i].v);
+    h[end-1].v = c[end-1].v;
+    for (int i=end-2; i>=b; --i)
+      h[i].v = Op::apply(h[i+1].v, c[i].v);
+  }
+
+  for (int x0=0; x0<n; x0+=16)
+  {
+    int w = std::min(16, n - x0);
+    for (int i=0; i<16; ++i)
+      block[i] = i < w ? Op::apply(h[x0+i].v, g[x0+i+k-1].v) : videntity;
+    transpose16(block);
+    for (int r=0; r<count; ++r)
+    {
+      if (w == 16)
+        _mm_storeu_si128((__m128i*)(dst[r] + x0), block[r]);
+      else
+      {
+        uchar tail[16];
+        _mm_storeu_si128((__m128i*)tail, block[r]);
+        std::copy(tail, tail + w, dst[r] + x0);
+      }
+    }
+  }
+}
+#endif
+
+// Rows of a whole image
+struct SourceRows
+{
+  const cv::Mat& img;
+
+  const uchar* operator()(int y) const { return img.ptr<uchar>(y); }
+};
+
+struct ImageRows
+{
+  cv::Mat& img;
+  int rows, cols;
+
+  uchar* row(int y) const { return img.ptr<uchar>(y); }
+  void done(int) const { }
+};
+
+// Horizontal pass of another operation, applied to each output row and
+// written to dst, which is told when rows are ready. The rows come in order
+// and are grouped in strips of 16.
+template<class Op, class Target>
+struct RowFilter
+{
+  const Target& dst;
+  int k;
+  PassScratch& scratch;
+
+  void operator()(int y, const uchar* row) const
+  {
+    if (k == 1)
+    {
+      std::copy(row, row + dst.cols, dst.row(y));
+      dst.done(y);
+      return;
+    }
+#if defined(__SSE2__)
+    cv::Mat& strip = scratch.strip;
+    if (y % STRIP == 0)
+      strip.create(STRIP, dst.cols, CV_8UC1);
+    std::copy(row, row + dst.cols, strip.ptr<uchar>(y % STRIP));
+    if (y % STRIP != STRIP-1 && y != dst.rows-1)
+      return;
+
+    int first = y - y % STRIP;
+    int count = y - first + 1;
+    const uchar* src[STRIP];
+    uchar* out[STRIP];
+    for (int r=0; r<STRIP; ++r)
+    {
+      src[r] = strip.ptr<uchar>(r);
+      out[r] = r < count ? dst.row(first + r) : NULL;
+    }
+    vhgw_strip<Op>(src, out, count, dst.cols, k);
+#else
+    vhgw_row<Op>(row, dst.row(y), dst.cols, k);
+#endif
+    dst.done(y);
+  }
+};
+
+// Element-wise op of two rows, 16 pixels at a time where SSE2 is available
+static inline void apply_rows(const uchar* a, const uchar* b, uchar* out, int n, MinOp)
+{
+  int x = 0;
+#if defined(__SSE2__)
+  for (; x+16<=n; x+=16)
+    _mm_storeu_si128((__m128i*)(out + x), _mm_min_epu8(_mm_loadu_si128((const __m128i*)(a + x)),
+                                                        _mm_loadu_si128((const __m128i*)(b + x))));
+#endif
+  for (; x<n; ++x) out[x] = a[x] < b[x] ? a[x] : b[x];
+}
+
+static inline void apply_rows(const uchar* a, const uchar* b, uchar* out, int n, MaxOp)
+{
+  int x = 0;
+#if defined(__SSE2__)
+  for (; x+16<=n; x+=16)
+    _mm_storeu_si128((__m128i*)(out + x), _mm_max_epu8(_mm_loadu_si128((const __m128i*)(a + x)),
+                                                        _mm_loadu_si128((const __m128i*)(b + x))));
+#endif
+  for (; x<n; ++x) out[x] = a[x] > b[x] ? a[x] : b[x];
+}
+
+// Vertical pass, window of k rows anchored at k/2. Only one block of
+// suffixes and one of prefixes (2k rows) are kept, and every output row is
+// handed to sink as soon as it is ready. The source rows may arrive a few
+// at a time: advance() processes the blocks whose rows are all available,
+// and a block reads no row older than its first one minus the anchor.
+template<class Op, class Sink>
+class ColumnStream
+{
+  private:
+    int m_rows, m_cols, m_k, m_anchor, m_len;
+    const Sink& m_sink;
+    PassScratch& m_scratch;
+    int m_block;
+
+  public:
+    ColumnStream(int rows, int cols, int k, const Sink& sink, PassScratch& scratch)
+      : m_rows(rows), m_cols(cols), m_k(k), m_anchor(k/2), m_len(rows + k - 1),
+        m_sink(sink), m_scratch(scratch), m_block(0)
+    {
+      uchar identity = Op::identity;
+      m_scratch.identity_row.assign(cols, identity);
+      m_scratch.out_row.resize(cols);
+      m_scratch.rows_h.create(k, cols, CV_8UC1);
+      m_scratch.rows_g.create(k, cols, CV_8UC1);
+    }
+
+    // Rows [0, available) of the source can be read through src
+    template<class Rows>
+    void advance(const Rows& src, int available)
+    {
+      int rows = m_rows, cols = m_cols, k = m_k, anchor = m_anchor, len = m_len;
+      const uchar* identity_row = m_scratch.identity_row.data();
+      uchar* out = m_scratch.out_row.data();
+      cv::Mat& hb = m_scratch.rows_h;
+      cv::Mat& gb = m_scratch.rows_g;
+
+      // padded row i
+      auto row = [&](int i) -> const uchar* {
+        return (i < anchor || i >= anchor + rows) ? identity_row : src(i - anchor);
+      };
+
+      for (; m_block<rows; m_block+=k)
+      {
+        int b = m_block;
+        int hend = std::min(b + k, len);
+        int out_end = std::min(b + k, rows);
+        int gend = std::min(out_end + k - 1, len);
+        if (std::min(gend - anchor, rows) > available)
+          return;
+
+        // suffixes of the block [b, b+k)
+        std::copy(row(hend-1), row(hend-1) + cols, hb.ptr<uchar>(hend-1-b));
+        for (int i=hend-2; i>=b; --i)
+          apply_rows(hb.ptr<uchar>(i+1-b), row(i), hb.ptr<uchar>(i-b), cols, Op());
+
+        // prefixes of the next block, as far as the outputs of this block need them
+        for (int i=b+k; i<gend; ++i)
+        {
+          if (i == b+k)
+            std::copy(row(i), row(i) + cols, gb.ptr<uchar>(0));
+          else
+            apply_rows(gb.ptr<uchar>(i-1-b-k), row(i), gb.ptr<uchar>(i-b-k), cols, Op());
+        }
+
+        // the window of the first row of the block is the block itself
+        m_sink(b, hb.ptr<uchar>(0));
+        for (int x=b+1; x<out_end; ++x)
+        {
+          apply_rows(hb.ptr<uchar>(x-b), gb.ptr<uchar>(x-1-b), out, cols, Op());
+          m_sink(x, out);
+        }
+      }
+    }
+};
+
+// Intermediate image of an opening or closing: only its last rows are kept,
+// and the second pass is advanced as soon as rows are ready
+template<class Next>
+struct RingRows
+{
+  cv::Mat& ring;
+  int rows, cols;
+  Next& next;
+
+  uchar* row(int y) const { return ring.ptr<uchar>(y % ring.rows); }
+  const uchar* operator()(int y) const { return ring.ptr<uchar>(y % ring.rows); }
+  void done(int y) const { next.advance(*this, y + 1); }
+};
+
+static void check_input(const cv::Mat& src)
+{
+  if (src.type() != CV_8UC1)
+  {
+    throw std::runtime_error("Rectangular morphology needs an 8-bit single channel image");
+  }
+}
+
+template<class Op>
+static void morph_into(const cv::Mat& src, cv::Mat& dst, cv::Size ksize)
+{
+  ImageRows target = { dst, dst.rows, dst.cols };
+  RowFilter<Op, ImageRows> filter = { target, ksize.width, t_scratch.passes[0] };
+  ColumnStream<Op, RowFilter<Op, ImageRows> > pass(src.rows, src.cols, ksize.height, filter, t_scratch.passes[0]);
+  pass.advance(SourceRows{src}, src.rows);
+}
+
+template<class Op>
+static void morph_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize)
+{
+  check_input(src);
+  // The rows of dst are written while the rows below them in src are still
+  // being read: in place, go through the scratch image
+  if (dst.data == src.data)
+  {
+    cv::Mat& tmp = t_scratch.tmp;
+    tmp.create(src.size(), CV_8UC1);
+    morph_into<Op>(src, tmp, ksize);
+    tmp.copyTo(dst);
+    return;
+  }
+  dst.create(src.size(), CV_8UC1);
+  morph_into<Op>(src, dst, ksize);
+}
+
+// The rows of the first operation go through a ring of 2k+16 rows into the
+// second one, which runs as soon as they are ready: no intermediate image
+template<class First, class Second>
+static void morph_pair_into(const cv::Mat& src, cv::Mat& dst, cv::Size ksize)
+{
+  typedef RowFilter<Second, ImageRows> SecondFilter;
+  typedef ColumnStream<Second, SecondFilter> SecondPass;
+  typedef RingRows<SecondPass> Ring;
+
+  ImageRows target = { dst, dst.rows, dst.cols };
+  SecondFilter second_filter = { target, ksize.width, t_scratch.passes[1] };
+  SecondPass second(src.rows, src.cols, ksize.height, second_filter, t_scratch.passes[1]);
+
+  // a strip of rows arrives at once while the second pass still reads up
+  // to 2k-1 rows before it
+  t_scratch.ring.create(std::min(src.rows, 2*ksize.height + STRIP), src.cols, CV_8UC1);
+  Ring ring = { t_scratch.ring, src.rows, src.cols, second };
+  RowFilter<First, Ring> first_filter = { ring, ksize.width, t_scratch.passes[0] };
+  ColumnStream<First, RowFilter<First, Ring> > first(src.rows, src.cols, ksize.height, first_filter, t_scratch.passes[0]);
+  first.advance(SourceRows{src}, src.rows);
+}
+
+template<class First, class Second>
+static void morph_pair(const cv::Mat& src, cv::Mat& dst, cv::Size ksize)
+{
+  check_input(src);
+  if (dst.data == src.data)
+  {
+    cv::Mat& tmp = t_scratch.tmp;
+    tmp.create(src.size(), CV_8UC1);
+    morph_pair_into<First, Second>(src, tmp, ksize);
+    tmp.copyTo(dst);
+    return;
+  }
+  dst.create(src.size(), CV_8UC1);
+  morph_pair_into<First, Second>(src, dst, ksize);
+}
+
+void erode_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize)
+{
+  morph_rect<MinOp>(src, dst, ksize);
+}
+
+void dilate_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize)
+{
+  morph_rect<MaxOp>(src, dst, ksize);
+}
+
+void open_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize)
+{
+  morph_pair<MinOp, MaxOp>(src, dst, ksize);
+}
+
+void close_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize)
+{
+  morph_pair<MaxOp, MinOp>(src, dst, ksize);
+}
@@ -0,0 +1,23 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include <opencv2/core.hpp>
+
+// Erosion and dilation of 8-bit single channel images with rectangular
+// kernels, by the van Herk/Gil-Werman algorithm: 3 min/max per pixel and
+// direction, whatever the kernel size. Border handling and anchor (the
+// kernel center) are the ones of cv::erode/cv::dilate with default
+// arguments, so the results are identical. src and dst may be the same.
+// The opening and closing stream the rows of the first operation straight
+// into the second one through a ring of 2*ksize.height+16 rows, instead of
+// an intermediate image.
+
+void erode_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize);
+void dilate_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize);
+
+// erode then dilate
+void open_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize);
+// dilate then erode
+void close_rect(const cv::Mat& src, cv::Mat& dst, cv::Size ksize);
+
+#endif
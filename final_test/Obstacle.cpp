@@ -1,7 +1,17 @@
 #include "Obstacle.h"
 
-Obstacle::Obstacle (cv::Rect rect) : m_bbox(rect) { }
+Obstacle::Obstacle (cv::Rect rect) : m_id(-1), m_bbox(rect) { }
 
-cv::Rect Obstacle::get_bounding_box () {
+Obstacle::Obstacle (int id, cv::Rect rect) : m_id(id), m_bbox(rect) { }
+
+int Obstacle::get_id () const {
+  return m_id;
+}
+
+cv::Rect Obstacle::get_bounding_box () const {
   return m_bbox;
+}
+
+void Obstacle::set_bounding_box (cv::Rect rect) {
+  m_bbox = rect;
 }
\ No newline at end of file
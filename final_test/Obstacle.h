@@ -6,10 +6,14 @@
 class Obstacle
 {
   private:
+    int m_id;
     cv::Rect m_bbox;
 
   public:
     Obstacle(cv::Rect rect);
-    cv::Rect get_bounding_box();
+    Obstacle(int id, cv::Rect rect);
+    int get_id() const;
+    cv::Rect get_bounding_box() const;
+    void set_bounding_box(cv::Rect rect);
 };
 #endif
\ No newline at end of file
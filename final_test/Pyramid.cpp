@@ -0,0 +1,136 @@
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "Pyramid.h"
+#include "Trace.h"
+
+void ImagePyramid::build (const cv::Mat& img, int top_level)
+{
+  TRACE_SCOPE("pyramid");
+  m_bgr.resize(top_level + 1);
+  m_hsv.assign(top_level + 1, cv::Mat());
+  m_bgr[0] = img;
+  for (int l=1; l<=top_level; ++l)
+    cv::pyrDown(m_bgr[l-1], m_bgr[l]);
+}
+
+const cv::Mat& ImagePyramid::hsv (int level) const
+{
+  if (m_hsv[level].empty())
+    cv::cvtColor(m_bgr[level], m_hsv[level], cv::COLOR_BGR2HSV);
+  return m_hsv[level];
+}
+
+// Grow every window until it no longer overlaps another one, so that each
+// blob is refined exactly once
+static void merge_windows(std::vector<cv::Rect>& windows)
+{
+  bool merged = true;
+  while (merged)
+  {
+    merged = false;
+    for (int i=0; i<windows.size() && !merged; ++i)
+    {
+      for (int j=i+1; j<windows.size(); ++j)
+      {
+        if ((windows[i] & windows[j]).area() == 0) continue;
+        windows[i] |= windows[j];
+        windows.erase(windows.begin() + j);
+        merged = true;
+        break;
+      }
+    }
+  }
+}
+
+void find_contours_coarse_to_fine(const ImagePyramid& pyramid, int level, ColorMask mask,
+                                  std::vector<std::vector<cv::Point>>& contours,
+                                  cv::Mat* full_mask)
+{
+  TRACE_SCOPE("coarse_to_fine");
+  int s = ImagePyramid::scale(level);
+  const cv::Mat& full = pyramid.bgr(0);
+  cv::Rect bounds(0, 0, full.cols, full.rows);
+
+  cv::Mat coarse_mask;
+  mask(pyramid.hsv(level), coarse_mask);
+  std::vector<std::vector<cv::Point>> coarse;
+  cv::findContours(coarse_mask, coarse, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+  // A margin of two coarse pixels covers the blur of the pyramid and the
+  // parts of the blob too thin to survive the downsampling
+  int margin = 2*s + 2;
+  std::vector<cv::Rect> windows;
+  for (int i=0; i<coarse.size(); ++i)
+  {
+    cv::Rect r = cv::boundingRect(coarse[i]);
+    windows.push_back(cv::Rect(r.x*s - margin, r.y*s - margin,
+                               r.width*s + 2*margin, r.height*s + 2*margin) & bounds);
+  }
+  merge_windows(windows);
+
+  if (full_mask)
+    *full_mask = cv::Mat::zeros(full.size(), CV_8UC1);
+
+  contours.clear();
+  std::vector<std::vector<cv::Point>> window_contours;
+  for (int i=0; i<windows.size(); ++i)
+  {
+    cv::Mat hsv_window, window_mask;
+    cv::cvtColor(full(windows[i]), hsv_window, cv::COLOR_BGR2HSV);
+    mask(hsv_window, window_mask);
+    if (full_mask)
+      window_mask.copyTo((*full_mask)(windows[i]));
+    cv::findContours(window_mask, window_contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE,
+                     windows[i].tl());
+    contours.insert(contours.end(), window_contours.begin(), window_contours.end());
+  }
+}
+
+void refine_corners(const ImagePyramid& pyramid, int level, ColorMask mask,
+                    std::vector<cv::Point2f>& corners)
+{
+  TRACE_SCOPE("refine_corners");
+  int s = ImagePyramid::scale(level);
+  const cv::Mat& full = pyramid.bgr(0);
+  cv::Rect bounds(0, 0, full.cols, full.rows);
+
+  cv::Point2f center(0, 0);
+  for (int i=0; i<corners.size(); ++i)
+    center += corners[i] * (1.f/corners.size());
+
+  int half = 2*s + 4;
+  std::vector<std::vector<cv::Point>> contours;
+  for (int i=0; i<corners.size(); ++i)
+  {
+    cv::Point c(corners[i].x, corners[i].y);
+    cv::Rect window = cv::Rect(c.x - half, c.y - half, 2*half + 1, 2*half + 1) & bounds;
+    if (window.area() == 0) continue;
+
+    cv::Mat hsv_window, window_mask;
+    cv::cvtColor(full(window), hsv_window, cv::COLOR_BGR2HSV);
+    mask(hsv_window, window_mask);
+    cv::findContours(window_mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE, window.tl());
+
+    // The corner is the boundary point farthest out along the direction from
+    // the center of the polygon; points on the window border are cuts of
+    // the blob, not part of its boundary
+    cv::Point2f dir = corners[i] - center;
+    dir *= 1.f / std::max(1e-6f, (float)cv::norm(dir));
+    double best = -INFINITY;
+    cv::Point2f best_point = corners[i];
+    for (int j=0; j<contours.size(); ++j)
+    {
+      for (int k=0; k<contours[j].size(); ++k)
+      {
+        const cv::Point& p = contours[j][k];
+        if (p.x == window.x || p.y == window.y
+            || p.x == window.x + window.width - 1 || p.y == window.y + window.height - 1)
+          continue;
+        double d = (p.x - center.x) * dir.x + (p.y - center.y) * dir.y;
+        if (d > best) { best = d; best_point = cv::Point2f(p.x, p.y); }
+      }
+    }
+    corners[i] = best_point;
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+// Color mask of an HSV image (see the masks of Arena.h)
+typedef void (*ColorMask)(const cv::Mat& hsv_img, cv::Mat& mask);
+
+// Gaussian pyramid of one frame, built once and shared by all the stages.
+// Level 0 is the frame itself, level l is downsampled by 2^l; the HSV
+// conversion of a level is done the first time it is needed.
+class ImagePyramid
+{
+	private:
+		std::vector<cv::Mat> m_bgr;
+		mutable std::vector<cv::Mat> m_hsv;
+
+	public:
+		void build(const cv::Mat& img, int top_level);
+
+		int levels() const { return m_bgr.size(); }
+		static int scale(int level) { return 1 << level; }
+
+		const cv::Mat& bgr(int level) const { return m_bgr[level]; }
+		const cv::Mat& hsv(int level) const;
+};
+
+// External contours of mask(frame) at full resolution. The blobs are found at
+// the given level, and the full resolution mask is only computed in windows
+// around them; blobs too small to be seen at that level are lost.
+// When full_mask is given it receives the full resolution mask, zero outside
+// the windows.
+void find_contours_coarse_to_fine(const ImagePyramid& pyramid, int level, ColorMask mask,
+                                  std::vector<std::vector<cv::Point>>& contours,
+                                  cv::Mat* full_mask = NULL);
+
+// Move each corner of a polygon found at a coarse level to the outermost
+// point of the full resolution mask in a small window around it
+void refine_corners(const ImagePyramid& pyramid, int level, ColorMask mask,
+                    std::vector<cv::Point2f>& corners);
+
+#endif
@@ -0,0 +1,111 @@
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <cmath>
+
+#include "RobotTracker.h"
+#include "BitMask.h"
+#include "Trace.h"
+#include "LatencyStats.h"
+
+RobotTracker::RobotTracker ()
+  : m_velocity(0, 0), m_marker_radius(0),
+    m_last_full_search(false)
+{ }
+
+const RobotPose& RobotTracker::track (const cv::Mat& frame, const TopViewMap& top_view, int64_t timestamp_ns)
+{
+  TRACE_SCOPE("robot_pose");
+  FRAME_LATENCY();
+  RobotPose pose;
+  m_last_full_search = false;
+
+  if (m_pose.found)
+  {
+    // Constant velocity prediction; the window covers the marker at the
+    // predicted position and the error of the prediction
+    double dt = (timestamp_ns - m_pose.timestamp_ns) * 1e-9;
+    cv::Point2f predicted = m_pose.position + m_velocity * dt;
+    cv::Point2f motion = m_velocity * dt;
+    int half_w = (int)(m_marker_radius + std::abs(motion.x) + WINDOW_MARGIN);
+    int half_h = (int)(m_marker_radius + std::abs(motion.y) + WINDOW_MARGIN);
+    m_last_window = cv::Rect((int)predicted.x - half_w, (int)predicted.y - half_h, 2*half_w, 2*half_h)
+                  & top_view.bounds();
+
+    cv::Mat patch = top_view.sample(frame, m_last_window);
+    if (!patch.empty())
+      find_marker(patch, m_last_window.tl(), predicted, pose);
+  }
+
+  if (!pose.found)
+  {
+    // Lost: search the whole top view
+    m_last_full_search = true;
+    m_last_window = top_view.bounds();
+    cv::Point2f expected = m_pose.found ? m_pose.position : cv::Point2f(-1, -1);
+    find_marker(top_view.sample(frame, m_last_window), cv::Point(0, 0), expected, pose);
+  }
+
+  if (pose.found)
+  {
+    pose.timestamp_ns = timestamp_ns;
+    if (m_pose.found && timestamp_ns > m_pose.timestamp_ns)
+      m_velocity = (pose.position - m_pose.position) * (1e9 / (timestamp_ns - m_pose.timestamp_ns));
+    else
+      m_velocity = cv::Point2f(0, 0);
+  }
+  else
+  {
+    m_velocity = cv::Point2f(0, 0);
+  }
+  m_pose = pose;
+  return m_pose;
+}
+
+// Triangles of the marker color in a window of the top view; the one closest
+// to the expected position wins (the largest one when nothing is expected)
+bool RobotTracker::find_marker (const cv::Mat& patch, cv::Point offset, const cv::Point2f& expected, RobotPose& pose)
+{
+  cv::Mat hsv_patch, mask;
+  {
+    STAGE_LATENCY(STAGE_SEGMENTATION);
+    cv::cvtColor(patch, hsv_patch, cv::COLOR_BGR2HSV);
+    const std::vector<HsvRange>& ranges = get_color_config().ranges("robot");
+    BitMask bits;
+    threshold_hsv(hsv_patch, &ranges[0], ranges.size(), bits);
+    bits.to_mat(mask);
+  }
+
+  std::vector<std::vector<cv::Point>> contours;
+  std::vector<cv::Point> approx_curve;
+  cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE, offset);
+
+  double best_score = INFINITY;
+  for (int i=0; i<contours.size(); ++i)
+  {
+    cv::Moments m = cv::moments(contours[i]);
+    if (m.m00 < MIN_MARKER_AREA || m.m00 > MAX_MARKER_AREA) continue;
+
+    approxPolyDP(contours[i], approx_curve, 0.08 * cv::arcLength(contours[i], true), true);
+    if (approx_curve.size() != 3) continue;
+
+    cv::Point2f centroid(m.m10/m.m00, m.m01/m.m00);
+    double score = expected.x >= 0 ? cv::norm(centroid - expected) : -m.m00;
+    if (score >= best_score) continue;
+    best_score = score;
+
+    // The apex is the vertex farthest from the centroid (isosceles marker)
+    double radius = 0;
+    cv::Point2f apex;
+    for (int j=0; j<3; ++j)
+    {
+      cv::Point2f v(approx_curve[j].x, approx_curve[j].y);
+      double d = cv::norm(v - centroid);
+      if (d > radius) { radius = d; apex = v; }
+    }
+    pose.found = true;
+    pose.position = centroid;
+    pose.heading = std::atan2(apex.y - centroid.y, apex.x - centroid.x);
+    m_marker_radius = radius;
+  }
+  return pose.found;
+}
@@ -0,0 +1,52 @@
+#ifndef ROBOT_TRACKER_H
+#define ROBOT_TRACKER_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+#include "TopViewMap.h"
+
+struct RobotPose
+{
+	bool found;
+	cv::Point2f position;     // centroid of the marker in the top view
+	double heading;           // from the centroid towards the apex of the triangle [rad], y down
+	int64_t timestamp_ns;
+
+	RobotPose() : found(false), heading(0), timestamp_ns(0) { }
+};
+
+// Pose of the robot from its blue triangular marker, the "robot" class of
+// the colour config.
+// Only a window around the pose predicted from the last two updates is
+// sampled from the raw frame and segmented; the whole top view is searched
+// again when the marker is not found in the window.
+class RobotTracker
+{
+	private:
+		static const int MIN_MARKER_AREA = 150;       // top view pixels
+		static const int MAX_MARKER_AREA = 20000;
+		static const int WINDOW_MARGIN = 24;          // around the marker and the predicted motion
+
+		RobotPose m_pose;
+		cv::Point2f m_velocity;                       // top view pixels per second
+		double m_marker_radius;
+		cv::Rect m_last_window;
+		bool m_last_full_search;
+
+		bool find_marker(const cv::Mat& top_view_patch, cv::Point offset, const cv::Point2f& expected, RobotPose& pose);
+
+	public:
+		RobotTracker();
+
+		// Raw camera frame and its capture time
+		const RobotPose& track(const cv::Mat& frame, const TopViewMap& top_view, int64_t timestamp_ns);
+
+		void reset() { m_pose = RobotPose(); }
+
+		const RobotPose& pose() const { return m_pose; }
+		cv::Rect last_window() const { return m_last_window; }
+		bool last_full_search() const { return m_last_full_search; }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Segmentation.h"
+
+// Working set of a band: half of a 512 KB L2, the rest is left to the
+// lookup tables and the other hyperthread
+static const int BAND_BYTES = 256 * 1024;
+// Shorter bands spend too much of their time on the halo and the calls
+static const int MIN_BAND_ROWS = 16;
+
+int cache_band_rows(const cv::Mat& bgr, int n_masks)
+{
+  // BGR and HSV rows, then one byte per mask pixel (the bit masks are small)
+  int row_bytes = std::max(1, bgr.cols * (6 + n_masks));
+  return std::max(MIN_BAND_ROWS, BAND_BYTES / row_bytes);
+}
+
+class SegmentBands : public cv::ParallelLoopBody
+{
+  private:
+    const cv::Mat& m_bgr;
+    const std::vector<MaskSpec>& m_specs;
+    std::vector<cv::Mat>& m_masks;
+    cv::Mat* m_hsv;
+    int m_band_rows, m_halo;
+
+  public:
+    SegmentBands(const cv::Mat& bgr, const std::vector<MaskSpec>& specs, std::vector<cv::Mat>& masks,
+                 cv::Mat* hsv, int band_rows, int halo)
+      : m_bgr(bgr), m_specs(specs), m_masks(masks), m_hsv(hsv), m_band_rows(band_rows), m_halo(halo) { }
+
+    void operator()(const cv::Range& range) const
+    {
+      cv::Mat hsv_band, mask_band;
+      BitMask bits;
+      for (int b=range.start; b<range.end; ++b)
+      {
+        // Rows [begin, end) are written, [read_begin, read_end) are read
+        int begin = b * m_band_rows;
+        int end = std::min(begin + m_band_rows, m_bgr.rows);
+        int read_begin = std::max(begin - m_halo, 0);
+        int read_end = std::min(end + m_halo, m_bgr.rows);
+        cv::Range inner(begin - read_begin, end - read_begin);
+
+        cv::cvtColor(m_bgr.rowRange(read_begin, read_end), hsv_band, cv::COLOR_BGR2HSV);
+        if (m_hsv)
+          hsv_band.rowRange(inner).copyTo(m_hsv->rowRange(begin, end));
+
+        for (int i=0; i<m_specs.size(); ++i)
+        {
+          const MaskSpec& spec = m_specs[i];
+          cv::Mat out = m_masks[i].rowRange(begin, end);
+          if (spec.close_ksize <= 1)
+          {
+            // No neighbourhood: the inner rows straight into the output
+            threshold_hsv(hsv_band.rowRange(inner), spec.ranges, spec.n_ranges, bits);
+            bits.to_mat(out);
+            continue;
+          }
+          threshold_hsv(hsv_band, spec.ranges, spec.n_ranges, bits);
+          close_rect(bits, bits, cv::Size(spec.close_ksize, spec.close_ksize));
+          bits.to_mat(mask_band);
+          mask_band.rowRange(inner).copyTo(out);
+        }
+      }
+    }
+};
+
+void segment_masks(const cv::Mat& bgr, const std::vector<MaskSpec>& specs,
+                   std::vector<cv::Mat>& masks, cv::Mat* hsv_img, int band_rows)
+{
+  if (bgr.type() != CV_8UC3)
+    throw std::runtime_error("Segmentation needs an 8-bit BGR image");
+
+  // A closing reaches r rows with the dilation, then r more with the erosion
+  int halo = 0;
+  for (int i=0; i<specs.size(); ++i)
+    halo = std::max(halo, specs[i].close_ksize - 1);
+
+  masks.resize(specs.size());
+  for (int i=0; i<masks.size(); ++i)
+    masks[i].create(bgr.size(), CV_8UC1);
+  if (hsv_img)
+    hsv_img->create(bgr.size(), CV_8UC3);
+  if (bgr.empty()) return;
+
+  if (band_rows <= 0)
+    band_rows = cache_band_rows(bgr, specs.size());
+  int n_bands = (bgr.rows + band_rows - 1) / band_rows;
+  cv::parallel_for_(cv::Range(0, n_bands), SegmentBands(bgr, specs, masks, hsv_img, band_rows, halo), n_bands);
+}
@@ -0,0 +1,31 @@
+#ifndef SEGMENTATION_H
+#define SEGMENTATION_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+#include "BitMask.h"
+
+// One colour mask of a segmentation: the pixels in any of the ranges,
+// closed with a close_ksize x close_ksize kernel (1 for no closing)
+struct MaskSpec
+{
+	const HsvRange* ranges;
+	int n_ranges;
+	int close_ksize;
+};
+
+// Rows of a BGR image per band small enough for the band to stay in the
+// L2 cache through all the stages of segment_masks
+int cache_band_rows(const cv::Mat& bgr, int n_masks);
+
+// HSV conversion, thresholds and closings of a BGR image, one band of rows
+// at a time: every band goes through all the stages while it is in the
+// cache, and the bands run in parallel on the OpenCV thread pool. A band
+// reads close_ksize-1 halo rows of its neighbours, so the masks are the
+// same as with one band covering the whole image. band_rows 0 picks
+// cache_band_rows. The HSV image is only written when hsv_img is given.
+void segment_masks(const cv::Mat& bgr, const std::vector<MaskSpec>& specs,
+                   std::vector<cv::Mat>& masks, cv::Mat* hsv_img = NULL, int band_rows = 0);
+
+#endif
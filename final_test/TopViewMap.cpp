@@ -0,0 +1,40 @@
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "TopViewMap.h"
+#include "LatencyStats.h"
+
+void TopViewMap::build (ArenaDetector& detector, const cv::Mat& persp_transf, cv::Size frame_size)
+{
+  cv::Mat undist_x, undist_y;
+  cv::initUndistortRectifyMap(detector.camera_matrix(), detector.dist_coeffs(), cv::Mat(),
+                              detector.new_camera_matrix(frame_size), frame_size,
+                              CV_32FC1, undist_x, undist_y);
+  m_crop = arena_crop(frame_size);
+
+  // The crop starts at the origin of the top view, so it is just a smaller output
+  cv::warpPerspective(undist_x, m_map_x, persp_transf, m_crop.size(),
+                      cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(-1));
+  cv::warpPerspective(undist_y, m_map_y, persp_transf, m_crop.size(),
+                      cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(-1));
+  cv::convertMaps(m_map_x, m_map_y, m_map1, m_map2, CV_16SC2);
+}
+
+cv::Mat TopViewMap::sample (const cv::Mat& frame, const cv::Rect& window) const
+{
+  STAGE_LATENCY(STAGE_UNDISTORT);
+  cv::Rect r = window & bounds();
+  cv::Mat patch;
+  if (r.area() > 0)
+    cv::remap(frame, patch, m_map1(r), m_map2(r), cv::INTER_LINEAR);
+  return patch;
+}
+
+void TopViewMap::decimated (int scale, cv::Mat& map1, cv::Mat& map2) const
+{
+  cv::Mat small_x, small_y;
+  cv::Size small_size((m_crop.width + scale-1)/scale, (m_crop.height + scale-1)/scale);
+  cv::resize(m_map_x, small_x, small_size, 0, 0, cv::INTER_NEAREST);
+  cv::resize(m_map_y, small_y, small_size, 0, 0, cv::INTER_NEAREST);
+  cv::convertMaps(small_x, small_y, map1, map2, CV_16SC2);
+}
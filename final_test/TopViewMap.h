@@ -0,0 +1,33 @@
+#ifndef TOP_VIEW_MAP_H
+#define TOP_VIEW_MAP_H
+
+#include <opencv2/core.hpp>
+
+#include "Arena.h"
+
+// Remap table going straight from the raw camera frame to the cropped top
+// view of the arena: the undistortion and the perspective transformation are
+// composed once, so any window of the top view can be sampled on its own.
+class TopViewMap
+{
+	private:
+		cv::Rect m_crop;
+		cv::Mat m_map1, m_map2;                   // fixed point, for cv::remap
+		cv::Mat m_map_x, m_map_y;                 // float, kept to build decimated copies
+
+	public:
+		void build(ArenaDetector& detector, const cv::Mat& persp_transf, cv::Size frame_size);
+		bool empty() const { return m_map1.empty(); }
+
+		// Size of the top view (the arena crop)
+		cv::Size size() const { return m_crop.size(); }
+		cv::Rect bounds() const { return cv::Rect(0, 0, m_crop.width, m_crop.height); }
+
+		// Window of the top view, clipped to its bounds
+		cv::Mat sample(const cv::Mat& frame, const cv::Rect& window) const;
+
+		// Whole top view at 1/scale resolution, sampled through the returned maps
+		void decimated(int scale, cv::Mat& map1, cv::Mat& map2) const;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "Trace.h"
+
+#ifdef ENABLE_TRACING
+
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct TraceEvent
+{
+  const char* name;
+  long long begin_ns;
+  long long end_ns;
+  int arg;
+};
+
+// Every thread appends to its own buffer, so recording never takes a lock;
+// the registry is only touched the first time a thread records an event
+// and when the session is written out. busy is set while the thread
+// appends: end_session stops the recording, then waits for every buffer
+// to be idle before reading it.
+struct TraceBuffer
+{
+  int tid;
+  std::atomic<bool> busy;
+  std::vector<TraceEvent> events;
+
+  TraceBuffer() : tid(0), busy(false) { }
+};
+
+static std::mutex s_registry_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> s_buffers;
+static std::atomic<bool> s_active(false);
+static std::string s_filename;
+static long long s_session_begin = 0;
+
+static thread_local TraceBuffer* t_buffer = nullptr;
+
+
+void Trace::begin_session(const std::string& filename)
+{
+  std::lock_guard<std::mutex> lock(s_registry_mutex);
+  for (auto& buffer : s_buffers)
+    buffer->events.clear();
+  s_filename = filename;
+  s_session_begin = now_ns();
+  s_active.store(true);
+}
+
+
+void Trace::record(const char* name, long long begin_ns, long long end_ns, int arg)
+{
+  if (!s_active.load(std::memory_order_relaxed)) return;
+
+  if (t_buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+    s_buffers.emplace_back(new TraceBuffer());
+    t_buffer = s_buffers.back().get();
+    t_buffer->tid = (int)s_buffers.size();
+    t_buffer->events.reserve(4096);
+  }
+
+  // Checked again once busy is set: either end_session sees the flag and
+  // waits, or this sees the session stopped and appends nothing
+  TraceEvent event = { name, begin_ns, end_ns, arg };
+  t_buffer->busy.store(true);
+  if (s_active.load())
+    t_buffer->events.push_back(event);
+  t_buffer->busy.store(false);
+}
+
+
+// Write all the recorded events as "complete" (ph: X) events, with
+// timestamps in microseconds from the start of the session
+void Trace::end_session()
+{
+  s_active.store(false);
+  std::lock_guard<std::mutex> lock(s_registry_mutex);
+  for (auto& buffer : s_buffers)
+    while (buffer->busy.load())
+      std::this_thread::yield();
+
+  std::ofstream out(s_filename.c_str());
+  if (!out.is_open())
+  {
+    throw std::runtime_error("Could not open file " + s_filename);
+  }
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  out.setf(std::ios::fixed);
+  out.precision(3);
+  for (auto& buffer : s_buffers)
+  {
+    for (const TraceEvent& e : buffer->events)
+    {
+      out << (first ? "\n" : ",\n")
+          << "{\"name\":\"" << e.name << "\",\"cat\":\"arena\",\"ph\":\"X\""
+          << ",\"ts\":" << (e.begin_ns - s_session_begin) / 1000.0
+          << ",\"dur\":" << (e.end_ns - e.begin_ns) / 1000.0
+          << ",\"pid\":1,\"tid\":" << buffer->tid;
+      if (e.arg >= 0)
+        out << ",\"args\":{\"i\":" << e.arg << "}";
+      out << "}";
+      first = false;
+    }
+    buffer->events.clear();
+  }
+  out << "\n]}\n";
+}
+
+#endif
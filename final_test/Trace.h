@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Scoped tracing of the pipeline stages.
+// Build with -DENABLE_TRACING (make TRACE=1) to record every TRACE_SCOPE
+// as a Chrome trace event; the file written by TRACE_END_SESSION can be
+// opened in chrome://tracing or ui.perfetto.dev. Without the define all the
+// macros expand to nothing, so they can stay in the hot path.
+
+#ifdef ENABLE_TRACING
+
+#include <chrono>
+#include <string>
+
+class Trace
+{
+	public:
+		static void begin_session(const std::string& filename);
+		static void end_session();
+
+		// name must be a string literal: only the pointer is stored
+		static void record(const char* name, long long begin_ns, long long end_ns, int arg);
+
+		static long long now_ns()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+};
+
+class TraceScope
+{
+	private:
+		const char* m_name;
+		int m_arg;
+		long long m_begin;
+
+	public:
+		TraceScope(const char* name, int arg = -1) : m_name(name), m_arg(arg), m_begin(Trace::now_ns()) { }
+		~TraceScope() { Trace::record(m_name, m_begin, Trace::now_ns(), m_arg); }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_BEGIN_SESSION(filename) Trace::begin_session(filename)
+#define TRACE_END_SESSION()           Trace::end_session()
+#define TRACE_SCOPE(name)             TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_I(name, i)        TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, i)
+
+#else
+
+#define TRACE_BEGIN_SESSION(filename)
+#define TRACE_END_SESSION()
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_I(name, i)
+
+#endif
+
+#endif
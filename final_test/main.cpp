@@ -0,0 +1,52 @@
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <iostream>
+
+#include "Map.h"
+#include "Dubins.h"
+#include "Trace.h"
+#include "LatencyStats.h"
+
+
+int main(int argc, char* argv[])
+{
+
+  cv::Mat img;
+  img = cv::imread(argv[1], 1); //reading file
+  
+  if(img.empty()) {
+    throw std::runtime_error("Failed to open the file ");
+  }
+
+  // Optional colour classes exported by hsv_tuner
+  ColorConfig colors = ColorConfig::defaults();
+  if (argc > 2)
+    colors.load(argv[2]);
+
+  TRACE_BEGIN_SESSION("part1_trace.json");
+
+  Map map(img, colors);
+
+  for (int i=0; i<map.obstacles().size(); ++i)
+    cv::rectangle(img, map.obstacles()[i].get_bounding_box(), cv::Scalar(40,190,40), 2);
+  imshow("path",img);
+
+
+  vector<Point2f> trajectory;
+  trajectory = dubins(0, 0, (((double(-9) / double(2))) * PI), 600, 600, (PI / double(1)), 1);
+
+  TRACE_END_SESSION();
+  LatencyStats::print_summary(std::cout);
+
+  std::cout << trajectory << std::endl;
+
+/*
+  for (auto i : trajectory) {
+    Point2i point = i;
+    cv::circle(img, point, 2, cv::Scalar(40,190,40));
+  }
+
+  imshow("path",img);
+  */waitKey(0);
+
+}
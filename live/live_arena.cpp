@@ -0,0 +1,196 @@
+// live_arena.cpp:
+// Run the arena pipeline on a camera (or a recorded video) in tracking mode:
+// the full detection only runs on keyframes, and the other frames only update
+// the regions that have changed.
+// Usage: live_arena [camera_index|video_file] [--full] [--keyframe-interval N]
+//                   [--denoise K] [--headless] [--calib intrinsic_calibration.xml]
+//                   [--colors colors.yml] [--bundle calibration.bundle]
+// --full runs the full detection on every frame, for comparison.
+// --denoise applies a KxK median filter to every frame before the pipeline.
+// --colors loads the colour thresholds exported by hsv_tuner.
+// --bundle is the calibration bundle written by part122, mapped in place of
+// --calib unless it is missing or older.
+// The robot pose is tracked on every frame from its blue triangular marker.
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "../final_test/Arena.h"
+#include "../final_test/ArenaTracker.h"
+#include "../final_test/CalibrationBundle.h"
+#include "../final_test/LatencyStats.h"
+#include "../final_test/MedianFilter.h"
+#include "../final_test/RobotTracker.h"
+#include "../final_test/Trace.h"
+
+void openCapture(cv::VideoCapture& vc, const std::string& source)
+{
+  if (!source.empty() && source.find_first_not_of("0123456789") != std::string::npos)
+  {
+    if (!vc.open(source))
+      throw std::runtime_error("Failed to open the video " + source);
+    return;
+  }
+
+  if(vc.open(source.empty() ? 0 : std::atoi(source.c_str()))) {
+    // Set up the capture device properties
+    if (!(vc.set(cv::CAP_PROP_FRAME_WIDTH, 1280)
+          && vc.set(cv::CAP_PROP_FRAME_HEIGHT, 1024)
+          && vc.set(cv::CAP_PROP_FPS, 30)))
+    {
+      throw std::runtime_error("Failed to set parameters");
+    }
+  }
+  else throw std::runtime_error("Failed to open the camera");
+}
+
+void drawDetection(cv::Mat& top_view, const ArenaDetection& detection,
+                   const std::vector<cv::Rect>& regions, const RobotPose& pose)
+{
+  for (int i=0; i<detection.obstacles.size(); ++i)
+    cv::rectangle(top_view, detection.obstacles[i], cv::Scalar(0,170,220), 3, cv::LINE_AA);
+  for (int i=0; i<detection.victims.size(); ++i)
+  {
+    const Victim& victim = detection.victims[i];
+    cv::rectangle(top_view, victim.bbox, cv::Scalar(250,170,220), 3, cv::LINE_AA);
+    cv::putText(top_view, std::to_string(victim.digit), victim.bbox.tl(),
+                cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0,0,255), 2);
+  }
+  // Regions updated in this frame
+  for (int i=0; i<regions.size(); ++i)
+    cv::rectangle(top_view, regions[i], cv::Scalar(255,255,0), 1);
+
+  if (pose.found)
+  {
+    cv::Point center(pose.position.x, pose.position.y);
+    cv::Point tip(center.x + 40*std::cos(pose.heading), center.y + 40*std::sin(pose.heading));
+    cv::circle(top_view, center, 4, cv::Scalar(0,255,0), cv::FILLED);
+    cv::line(top_view, center, tip, cv::Scalar(0,255,0), 2, cv::LINE_AA);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  std::string source;
+  std::string calib_file = "../config/intrinsic_calibration.xml";
+  std::string colors_file;
+  std::string bundle_file = "../config/calibration.bundle";
+  bool full = false, headless = false;
+  int keyframe_interval = 300;
+  int denoise = 0;
+  for (int i=1; i<argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--full") full = true;
+    else if (arg == "--headless") headless = true;
+    else if (arg == "--keyframe-interval" && i+1 < argc) keyframe_interval = std::atoi(argv[++i]);
+    else if (arg == "--denoise" && i+1 < argc) denoise = std::atoi(argv[++i]);
+    else if (arg == "--calib" && i+1 < argc) calib_file = argv[++i];
+    else if (arg == "--colors" && i+1 < argc) colors_file = argv[++i];
+    else if (arg == "--bundle" && i+1 < argc) bundle_file = argv[++i];
+    else source = arg;
+  }
+
+  if (!colors_file.empty())
+  {
+    ColorConfig colors = ColorConfig::defaults();
+    colors.load(colors_file);
+    set_color_config(colors);
+  }
+
+  cv::Mat camera_matrix, dist_coeffs;
+  // The bundle is mapped instead of parsing the calibration and rebuilding
+  // the undistortion tables
+  CalibrationBundle bundle;
+  load_calibration(bundle_file, calib_file, bundle, camera_matrix, dist_coeffs);
+  ArenaDetector detector(camera_matrix, dist_coeffs);
+  if (bundle.is_open())
+    detector.set_undistort_maps(bundle.new_camera_matrix(), bundle.map1(), bundle.map2());
+  ArenaTracker tracker(detector, full ? 1 : keyframe_interval);
+  RobotTracker robot;
+
+  cv::VideoCapture vc;
+  openCapture(vc, source);
+
+  TRACE_BEGIN_SESSION("live_arena_trace.json");
+  LatencyStats::start_exporter("live_arena_latency.prom", 1000);
+
+  LatencyHistogram frame_latency, pose_latency;
+  int frames = 0, keyframes = 0, full_searches = 0;
+  cv::Mat frame;
+  bool terminating = false;
+  while (!terminating && vc.read(frame))
+  {
+    // one sample per stage for the arena and the robot of the frame
+    FRAME_LATENCY();
+    uint64_t begin = LatencyStats::now_ns();
+    if (denoise > 1)
+      median_filter(frame, frame, denoise);
+    const ArenaDetection& detection = tracker.track(frame);
+    frame_latency.add(LatencyStats::now_ns() - begin);
+    ++frames;
+    if (tracker.last_keyframe()) ++keyframes;
+    if (detection.found)
+    {
+      begin = LatencyStats::now_ns();
+      robot.track(frame, tracker.top_view(), begin);
+      pose_latency.add(LatencyStats::now_ns() - begin);
+      if (robot.last_full_search()) ++full_searches;
+    }
+
+    if (headless) continue;
+
+    // Without an arena the camera frame is shown as it is, so that the
+    // window and the keys stay alive
+    if (detection.found)
+    {
+      // One remap through the tracker's raw frame -> top view table, instead
+      // of undistorting and warping the whole frame again for the display
+      cv::Mat top_view = tracker.top_view().sample(frame, tracker.top_view().bounds());
+      drawDetection(top_view, detection, tracker.last_regions(), robot.pose());
+      cv::imshow("Arena", top_view);
+    }
+    else
+      cv::imshow("Arena", frame);
+
+    char c;
+    c = cv::waitKey(1);
+    switch (c)
+    {
+      case 'k':
+        tracker.reset();
+        break;
+      case 'q':
+        std::cout << "Terminating!" << std::endl;
+        terminating = true;
+        break;
+      default:
+        break;
+    }
+  }
+
+  LatencyStats::stop_exporter();
+  TRACE_END_SESSION();
+
+  std::cout << frames << " frames, " << keyframes << " keyframes, "
+            << tracker.drift_corrections() << " camera drift corrections, "
+            << detector.digit_cache().misses() << " digits read, "
+            << detector.digit_cache().hits() << " from the cache, "
+            << full_searches << " full searches of the robot" << std::endl;
+  LatencyStats::print_summary(std::cout);
+  std::cout << std::fixed << std::setprecision(3)
+            << "frame p50 " << frame_latency.quantile_ns(0.5) * 1e-6 << " ms, p95 "
+            << frame_latency.quantile_ns(0.95) * 1e-6 << " ms, p99 "
+            << frame_latency.quantile_ns(0.99) * 1e-6 << " ms" << std::endl
+            << "pose p50 " << pose_latency.quantile_ns(0.5) * 1e-6 << " ms, p95 "
+            << pose_latency.quantile_ns(0.95) * 1e-6 << " ms, p99 "
+            << pose_latency.quantile_ns(0.99) * 1e-6 << " ms" << std::endl;
+  return 0;
+}
@@ -1,6 +1,9 @@
 // undistort_image.cpp:
 // Load the calibration coefficients and use them to undistort the input from
 // a camera
+// Usage: undistort [--colors colors.yml]
+// --colors loads the colour thresholds exported by hsv_tuner, for the
+// border and the gate.
 
 
 #include <opencv2/core.hpp>
@@ -10,8 +13,10 @@
 #include <opencv2/imgcodecs.hpp>
 #include <iostream>
 #include <vector>
-#include <atomic>
-#include <unistd.h>
+
+#include "../final_test/Arena.h"
+#include "../final_test/ArenaBorder.h"
+#include "../final_test/ColorConfig.h"
 
 
 using namespace cv;
@@ -21,61 +26,13 @@ using namespace std;
 
 
 
-// Defintion of the function pickNPoints and the callback mouseCallback.
-// The function pickNPoints is used to display a window with a background
-// image, and to prompt the user to select n points on this image.
-cv::Mat result, bg_img;
-int idx = 0;
-std::string name;
-std::atomic<bool> done;
-int n;
-
-void mouseCallback(int event, int x, int y, int, void* p)
-{
-  if (event != EVENT_LBUTTONDOWN || done.load()) return;
-
-  if (result.rows <= idx) throw std::runtime_error("Something went wrong");
-  result.at<float>((int)idx, 0) = x;
-  result.at<float>((int)idx++, 1) = y;
-  cv::circle(bg_img, {x,y}, 20, Scalar(0,0,255), -1);
-  imshow(name.c_str(), bg_img);
-
-  if (idx >= n) {
-    usleep(500*1000);
-    done.store(true);
-  }
-}
-
-cv::Mat pickNPoints(int n0, const Mat& img)
-{
-  result = cv::Mat(n0, 2, CV_32F);
-  idx = 0;
-  bg_img = img.clone();
-  name = "Pick " + std::to_string(n0) + " points";
-  imshow(name.c_str(), bg_img);
-  namedWindow(name.c_str());
-  n = n0;
-
-  done.store(false);
-
-  setMouseCallback(name.c_str(), &mouseCallback, nullptr);
-  while (!done.load()) {
-    cv::waitKey(500);
-  }
-
-  destroyWindow(name.c_str());
-  return result;
-}
-
-
-// Example of function to determine the perspective transformation of a
-// rectangle on the ground plane (with manual intervention from the user, that
-// is required to select the 4 corner points of the rectangle, starting from the
-// top-left corner and proceeding in clockwise order, and the origin (top-left)
-// and scale of the transformed top view image).
-// Since the real size of the rectangle is known (width: 1m, height: 1.5m),
-// the fucntion returns also the pixel_scale, i.e. the size (in mm) of each
-// pixel in the top view image
+// Perspective transformation of the arena rectangle on the ground plane,
+// from the corners of its black border found in the image (no operator
+// picks the points). The corners are the intersections of the four sides
+// fitted to the border, turned as in the arena pipeline until the gate is
+// bottom-left, and the top view fills the image. Since the real size of the
+// rectangle is known (width: 1m, height: 1.5m), the function returns also
+// the pixel_scale, i.e. the size (in mm) of each pixel in the top view image
 Mat findTransform(const std::string& calib_image_name,
                   const cv::Mat& camera_matrix,
                   const cv::Mat& dist_coeffs,
@@ -90,42 +47,32 @@ Mat findTransform(const std::string& calib_image_name,
 
  // undistort(original_image, calib_image, camera_matrix, dist_coeffs);
 
-  cv::Mat corner_pixels = pickNPoints(4, calib_image);
+  // black border, with the thresholds of the arena pipeline
+  cv::Mat hsv_img, gray, black_mask;
+  cvtColor(calib_image, hsv_img, COLOR_BGR2HSV);
+  border_mask(hsv_img, black_mask);
+  cvtColor(calib_image, gray, COLOR_BGR2GRAY);
 
-  // generate and show a black image, corresponding to the top-view camera, and
-  // ask the user to select the origin and scale of the resulting image
-  cv::Mat screen_pixels = Mat(calib_image.rows, calib_image.cols, CV_8UC3, cv::Scalar(0,0,0));
-  cv::Mat dst_pixels = pickNPoints(2, screen_pixels);
-
-  float origin_x = dst_pixels.at<float>(0, 0),
-        origin_y = dst_pixels.at<float>(0, 1);
-
-  float delta_x = dst_pixels.at<float>(1, 0)-dst_pixels.at<float>(0, 0);
-  float delta_y = dst_pixels.at<float>(1, 1)-dst_pixels.at<float>(0, 1);
-
-  float delta_x_mm = 1000;
-  float delta_y_mm = 1500;
-
-  float scale_x = delta_x/delta_x_mm;
-  float scale_y = delta_y/delta_y_mm;
-  float scale = std::min(scale_x, scale_y);
-
-  pixel_scale = 1./scale;
-  delta_x = scale*delta_x_mm;
-  delta_y = scale*delta_y_mm;
-
-  cv::Mat transf_pixels = (cv::Mat_<float>(4,2) << origin_x, origin_y,
-                                                   origin_x+delta_x, origin_y,
-                                                   origin_x+delta_x, origin_y+delta_y,
-                                                   origin_x, origin_y+delta_y);
+  cv::Mat corner_pixels;
+  std::vector<cv::Point> border;
+  if (!fit_border(gray, black_mask, corner_pixels, border))
+  {
+    throw std::runtime_error("Could not find the arena border in " + calib_image_name);
+  }
 
-  cv::Mat transf = cv::getPerspectiveTransform(corner_pixels, transf_pixels);
-  cv::Mat unwarped_frame, concat;
-  warpPerspective(calib_image, unwarped_frame, transf, calib_image.size());
+  // The sides alone do not tell which corner is the origin: without the
+  // gate in a corner the transform would be a guess
+  cv::Mat transf, unwarped_frame;
+  std::vector<cv::Point> gate;
+  if (orient_border(calib_image, corner_pixels, transf, pixel_scale, unwarped_frame, gate) < 0)
+  {
+    throw std::runtime_error("Could not find the gate in a corner of the arena in " + calib_image_name);
+  }
+  cv::Mat concat;
   cv::hconcat(calib_image, unwarped_frame, concat);
   imshow("Unwarping", concat);
   imwrite("Unwarping1.jpg", concat);
-  //imwrite("test.jpg", transf);
+
   waitKey(0);
   return transf;
 }
@@ -209,8 +156,24 @@ void processVideo()
     // cv::destroyAllWindows();
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+  for (int i=1; i<argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--colors" && i+1 < argc)
+    {
+      ColorConfig colors = ColorConfig::defaults();
+      colors.load(argv[++i]);
+      set_color_config(colors);
+    }
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--colors colors.yml]" << std::endl;
+      return 1;
+    }
+  }
+
   processVideo();
   run();
   return 0;
@@ -0,0 +1,379 @@
+// arena_regression.cpp:
+// Run the headless arena pipeline over the labelled images, score the
+// detections against the labels and report the latency of every stage.
+// Each <name>.yml of the label directory (labels/) labels the image
+// <name>.jpg of the image directory (the sample frames of ../final_test):
+//   corners:   4x2 float, border corners in the undistorted frame
+//   gate:      Nx2 int, gate vertices in the top view
+//   obstacles: Nx4 int, x y w h of the obstacle boxes in the top view
+//   victims:   Nx5 int, x y w h digit of the victims in the top view
+// --record <name> writes the labels of <name>.jpg from the current output,
+// to be reviewed by hand before they are committed.
+// Usage: arena_regression [--images dir] [--labels dir] [--record name]...
+//                         [--report report.yml] [--calib intrinsic_calibration.xml]
+//                         [--pyramid level] [--colors colors.yml] [--bundle calibration.bundle]
+// --pyramid runs the coarse-to-fine detection on the given pyramid level.
+// --bundle is the calibration bundle written by part122, mapped in place of
+// --calib unless it is missing or older.
+// The exit status is 1 when any image is out of tolerance, or when there
+// is no label at all.
+
+#include <opencv2/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../final_test/Arena.h"
+#include "../final_test/CalibrationBundle.h"
+#include "../final_test/LatencyStats.h"
+
+static const double CORNER_TOL_PX   = 2;
+static const double GATE_TOL_PX     = 3;
+static const double OBSTACLE_MIN_IOU = 0.8;
+static const double VICTIM_TOL_PX   = 5;
+
+struct Labels
+{
+  cv::Mat corners;
+  std::vector<cv::Point> gate;
+  std::vector<cv::Rect> obstacles;
+  std::vector<Victim> victims;
+};
+
+struct Score
+{
+  bool border_ok;
+  double corner_err;        // max distance of the corners [px]
+  double gate_err;          // max distance of a gate vertex from the nearest label [px]
+  int obstacles_matched;
+  int obstacles_expected;
+  int obstacles_found;
+  int victims_matched;
+  int digits_matched;
+  int victims_expected;
+  int victims_found;
+  bool passed;
+};
+
+// <name> of a path dir/<name>.ext
+static std::string base_name(const std::string& path)
+{
+  size_t slash = path.find_last_of('/');
+  std::string file = slash == std::string::npos ? path : path.substr(slash + 1);
+  return file.substr(0, file.find_last_of('.'));
+}
+
+static bool load_labels(const std::string& filename, Labels& labels)
+{
+  cv::FileStorage fs( filename, cv::FileStorage::READ );
+  if (!fs.isOpened()) return false;
+
+  cv::Mat gate, obstacles, victims;
+  fs["corners"] >> labels.corners;
+  fs["gate"] >> gate;
+  fs["obstacles"] >> obstacles;
+  fs["victims"] >> victims;
+  fs.release();
+
+  labels.corners.convertTo(labels.corners, CV_32F);
+  for (int i=0; i<gate.rows; ++i)
+    labels.gate.push_back(cv::Point(gate.at<int>(i,0), gate.at<int>(i,1)));
+  for (int i=0; i<obstacles.rows; ++i)
+    labels.obstacles.push_back(cv::Rect(obstacles.at<int>(i,0), obstacles.at<int>(i,1),
+                                        obstacles.at<int>(i,2), obstacles.at<int>(i,3)));
+  for (int i=0; i<victims.rows; ++i)
+  {
+    Victim victim;
+    victim.bbox = cv::Rect(victims.at<int>(i,0), victims.at<int>(i,1),
+                           victims.at<int>(i,2), victims.at<int>(i,3));
+    victim.center = cv::Point2f(victim.bbox.x + victim.bbox.width/2.f, victim.bbox.y + victim.bbox.height/2.f);
+    victim.digit = victims.at<int>(i,4);
+    labels.victims.push_back(victim);
+  }
+  return true;
+}
+
+static void store_labels(const std::string& filename, const ArenaDetection& detection)
+{
+  cv::Mat gate((int)detection.gate.size(), 2, CV_32S);
+  for (int i=0; i<gate.rows; ++i)
+  {
+    gate.at<int>(i,0) = detection.gate[i].x;
+    gate.at<int>(i,1) = detection.gate[i].y;
+  }
+  cv::Mat obstacles((int)detection.obstacles.size(), 4, CV_32S);
+  for (int i=0; i<obstacles.rows; ++i)
+  {
+    const cv::Rect& r = detection.obstacles[i];
+    obstacles.at<int>(i,0) = r.x;     obstacles.at<int>(i,1) = r.y;
+    obstacles.at<int>(i,2) = r.width; obstacles.at<int>(i,3) = r.height;
+  }
+  cv::Mat victims((int)detection.victims.size(), 5, CV_32S);
+  for (int i=0; i<victims.rows; ++i)
+  {
+    const cv::Rect& r = detection.victims[i].bbox;
+    victims.at<int>(i,0) = r.x;     victims.at<int>(i,1) = r.y;
+    victims.at<int>(i,2) = r.width; victims.at<int>(i,3) = r.height;
+    victims.at<int>(i,4) = detection.victims[i].digit;
+  }
+
+  cv::FileStorage fs( filename, cv::FileStorage::WRITE );
+  fs << "corners" << detection.rectangular_points
+     << "gate" << gate
+     << "obstacles" << obstacles
+     << "victims" << victims;
+  fs.release();
+}
+
+static double iou(const cv::Rect& a, const cv::Rect& b)
+{
+  double inter = (a & b).area();
+  double uni = a.area() + b.area() - inter;
+  return uni > 0 ? inter/uni : 0;
+}
+
+// Greedy one-to-one matching: every label takes the best unused detection
+static int match_obstacles(const std::vector<cv::Rect>& expected, const std::vector<cv::Rect>& found)
+{
+  std::vector<bool> used(found.size(), false);
+  int matched = 0;
+  for (int i=0; i<expected.size(); ++i)
+  {
+    int best = -1;
+    double best_iou = OBSTACLE_MIN_IOU;
+    for (int j=0; j<found.size(); ++j)
+    {
+      double v = iou(expected[i], found[j]);
+      if (!used[j] && v >= best_iou) { best = j; best_iou = v; }
+    }
+    if (best >= 0) { used[best] = true; ++matched; }
+  }
+  return matched;
+}
+
+static void match_victims(const std::vector<Victim>& expected, const std::vector<Victim>& found,
+                          int& matched, int& digits_matched)
+{
+  std::vector<bool> used(found.size(), false);
+  matched = digits_matched = 0;
+  for (int i=0; i<expected.size(); ++i)
+  {
+    int best = -1;
+    double best_dist = VICTIM_TOL_PX;
+    for (int j=0; j<found.size(); ++j)
+    {
+      double d = cv::norm(expected[i].center - found[j].center);
+      if (!used[j] && d <= best_dist) { best = j; best_dist = d; }
+    }
+    if (best < 0) continue;
+    used[best] = true;
+    ++matched;
+    if (found[best].digit == expected[i].digit) ++digits_matched;
+  }
+}
+
+static Score score(const Labels& labels, const ArenaDetection& detection)
+{
+  Score s;
+  s.border_ok = detection.found && labels.corners.rows == 4;
+  s.corner_err = 0;
+  if (s.border_ok)
+  {
+    for (int i=0; i<4; ++i)
+    {
+      cv::Point2f a(labels.corners.at<float>(i,0), labels.corners.at<float>(i,1));
+      cv::Point2f b(detection.rectangular_points.at<float>(i,0), detection.rectangular_points.at<float>(i,1));
+      s.corner_err = std::max(s.corner_err, cv::norm(a - b));
+    }
+  }
+
+  s.gate_err = labels.gate.size() == detection.gate.size() ? 0 : INFINITY;
+  for (int i=0; i<detection.gate.size(); ++i)
+  {
+    double nearest = INFINITY;
+    for (int j=0; j<labels.gate.size(); ++j)
+      nearest = std::min(nearest, cv::norm(detection.gate[i] - labels.gate[j]));
+    s.gate_err = std::max(s.gate_err, nearest);
+  }
+
+  s.obstacles_expected = labels.obstacles.size();
+  s.obstacles_found = detection.obstacles.size();
+  s.obstacles_matched = match_obstacles(labels.obstacles, detection.obstacles);
+
+  s.victims_expected = labels.victims.size();
+  s.victims_found = detection.victims.size();
+  match_victims(labels.victims, detection.victims, s.victims_matched, s.digits_matched);
+
+  s.passed = s.border_ok && s.corner_err <= CORNER_TOL_PX && s.gate_err <= GATE_TOL_PX
+          && s.obstacles_matched == s.obstacles_expected && s.obstacles_found == s.obstacles_expected
+          && s.digits_matched == s.victims_expected && s.victims_found == s.victims_expected;
+  return s;
+}
+
+static void write_latency(cv::FileStorage& fs, const std::string& name, const LatencyHistogram& h)
+{
+  fs << name << "{"
+     << "count" << (int)h.count
+     << "p50_ms" << h.quantile_ns(0.5) * 1e-6
+     << "p95_ms" << h.quantile_ns(0.95) * 1e-6
+     << "p99_ms" << h.quantile_ns(0.99) * 1e-6
+     << "}";
+}
+
+int main(int argc, char* argv[])
+{
+  std::string image_dir = "../final_test";
+  std::string label_dir = "labels";
+  std::vector<std::string> record;
+  std::string report_file = "arena_regression.yml";
+  std::string calib_file = "../config/intrinsic_calibration.xml";
+  std::string colors_file;
+  std::string bundle_file = "../config/calibration.bundle";
+  int pyramid_level = 0;
+  for (int i=1; i<argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--images" && i+1 < argc) image_dir = argv[++i];
+    else if (arg == "--labels" && i+1 < argc) label_dir = argv[++i];
+    else if (arg == "--record" && i+1 < argc) record.push_back(argv[++i]);
+    else if (arg == "--report" && i+1 < argc) report_file = argv[++i];
+    else if (arg == "--calib" && i+1 < argc) calib_file = argv[++i];
+    else if (arg == "--pyramid" && i+1 < argc) pyramid_level = std::atoi(argv[++i]);
+    else if (arg == "--colors" && i+1 < argc) colors_file = argv[++i];
+    else if (arg == "--bundle" && i+1 < argc) bundle_file = argv[++i];
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--images dir] [--labels dir] [--record name]... [--report report.yml] [--calib file] [--pyramid level] [--colors file] [--bundle file]" << std::endl;
+      return 2;
+    }
+  }
+
+  if (!colors_file.empty())
+  {
+    ColorConfig colors = ColorConfig::defaults();
+    colors.load(colors_file);
+    set_color_config(colors);
+  }
+
+  cv::Mat camera_matrix, dist_coeffs;
+  // The bundle is mapped instead of parsing the calibration and rebuilding
+  // the undistortion tables
+  CalibrationBundle bundle;
+  load_calibration(bundle_file, calib_file, bundle, camera_matrix, dist_coeffs);
+  ArenaDetector detector(camera_matrix, dist_coeffs);
+  if (bundle.is_open())
+    detector.set_undistort_maps(bundle.new_camera_matrix(), bundle.map1(), bundle.map2());
+  detector.set_pyramid_level(pyramid_level);
+
+  // The images are the labelled ones, or the ones to record
+  std::vector<std::string> names = record;
+  if (names.empty())
+  {
+    std::vector<cv::String> label_files;
+    cv::glob(label_dir + "/*.yml", label_files);
+    for (int i=0; i<label_files.size(); ++i)
+      names.push_back(base_name(label_files[i]));
+  }
+  if (names.empty())
+  {
+    std::cerr << "No labels in " << label_dir << ": nothing to score" << std::endl;
+    return 1;
+  }
+  std::vector<std::string> images;
+  for (int i=0; i<names.size(); ++i)
+    images.push_back(image_dir + "/" + names[i] + ".jpg");
+
+  // Warm up the OCR and the OpenCV buffers so that they do not skew the first sample
+  detector.detect(cv::imread(images[0], 1));
+  LatencyStats::reset();
+
+  LatencyHistogram frame_latency;
+  cv::FileStorage report( report_file, cv::FileStorage::WRITE );
+  report << "images" << "[";
+
+  int passed = 0, labelled = 0;
+  for (int i=0; i<images.size(); ++i)
+  {
+    cv::Mat frame = cv::imread(images[i], 1);
+    if (frame.empty())
+    {
+      throw std::runtime_error("Failed to open the file " + images[i]);
+    }
+
+    uint64_t begin = LatencyStats::now_ns();
+    ArenaDetection detection = detector.detect(frame);
+    frame_latency.add(LatencyStats::now_ns() - begin);
+
+    std::string labels_name = label_dir + "/" + names[i] + ".yml";
+    if (!record.empty())
+    {
+      store_labels(labels_name, detection);
+      std::cout << "recorded " << labels_name << std::endl;
+      continue;
+    }
+
+    Labels labels;
+    if (!load_labels(labels_name, labels))
+    {
+      throw std::runtime_error("Could not open file " + labels_name);
+    }
+    ++labelled;
+
+    Score s = score(labels, detection);
+    if (s.passed) ++passed;
+
+    std::cout << (s.passed ? "PASS " : "FAIL ") << images[i]
+              << "  corners " << std::fixed << std::setprecision(2) << s.corner_err << "px"
+              << "  gate " << s.gate_err << "px"
+              << "  obstacles " << s.obstacles_matched << "/" << s.obstacles_expected
+              << " (" << s.obstacles_found << " found)"
+              << "  victims " << s.victims_matched << "/" << s.victims_expected
+              << " (" << s.victims_found << " found)"
+              << "  digits " << s.digits_matched << "/" << s.victims_expected << std::endl;
+
+    report << "{"
+           << "image" << images[i]
+           << "passed" << (int)s.passed
+           << "border_found" << (int)s.border_ok
+           << "corner_err_px" << s.corner_err
+           << "gate_err_px" << s.gate_err
+           << "obstacles_expected" << s.obstacles_expected
+           << "obstacles_found" << s.obstacles_found
+           << "obstacles_matched" << s.obstacles_matched
+           << "victims_expected" << s.victims_expected
+           << "victims_found" << s.victims_found
+           << "victims_matched" << s.victims_matched
+           << "digits_matched" << s.digits_matched
+           << "}";
+  }
+  report << "]";
+
+  report << "summary" << "{"
+         << "images" << (int)images.size()
+         << "labelled" << labelled
+         << "passed" << passed
+         << "}";
+
+  LatencyHistogram histograms[STAGE_COUNT];
+  LatencyStats::snapshot(histograms);
+  report << "latency" << "{";
+  write_latency(report, "frame", frame_latency);
+  for (int s=0; s<STAGE_COUNT; ++s)
+    write_latency(report, LatencyStats::stage_name((Stage)s), histograms[s]);
+  report << "}";
+  report.release();
+
+  std::cout << std::endl;
+  LatencyStats::print_summary(std::cout);
+  std::cout << std::fixed << std::setprecision(3)
+            << "frame p50 " << frame_latency.quantile_ns(0.5) * 1e-6 << " ms, p95 "
+            << frame_latency.quantile_ns(0.95) * 1e-6 << " ms" << std::endl;
+
+  if (!record.empty()) return 0;
+  std::cout << passed << "/" << labelled << " images within tolerance" << std::endl;
+  return labelled > 0 && passed == labelled ? 0 : 1;
+}